@@ -7,13 +7,15 @@
 using namespace Rcpp;
 
 // rcpp_make_compact_graph
-Rcpp::List rcpp_make_compact_graph(Rcpp::DataFrame graph);
-RcppExport SEXP osmprob_rcpp_make_compact_graph(SEXP graphSEXP) {
+Rcpp::List rcpp_make_compact_graph(Rcpp::DataFrame graph, int n_components, int min_component_size);
+RcppExport SEXP osmprob_rcpp_make_compact_graph(SEXP graphSEXP, SEXP n_componentsSEXP, SEXP min_component_sizeSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::DataFrame >::type graph(graphSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_make_compact_graph(graph));
+    Rcpp::traits::input_parameter< int >::type n_components(n_componentsSEXP);
+    Rcpp::traits::input_parameter< int >::type min_component_size(min_component_sizeSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_make_compact_graph(graph, n_components, min_component_size));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -29,6 +31,18 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// rcpp_osm_xml_as_network
+Rcpp::List rcpp_osm_xml_as_network(std::string file, Rcpp::DataFrame pr);
+RcppExport SEXP osmprob_rcpp_osm_xml_as_network(SEXP fileSEXP, SEXP prSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type file(fileSEXP);
+    Rcpp::traits::input_parameter< Rcpp::DataFrame >::type pr(prSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_osm_xml_as_network(file, pr));
+    return rcpp_result_gen;
+END_RCPP
+}
 // rcpp_router
 Rcpp::NumericMatrix rcpp_router(Rcpp::DataFrame netdf, int start_nodei, int end_nodei, double eta);
 RcppExport SEXP osmprob_rcpp_router(SEXP netdfSEXP, SEXP start_nodeiSEXP, SEXP end_nodeiSEXP, SEXP etaSEXP) {
@@ -44,8 +58,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // rcpp_router_prob
-Rcpp::NumericVector rcpp_router_prob(Rcpp::DataFrame netdf, long long start_node, long long end_node, double eta);
-RcppExport SEXP osmprob_rcpp_router_prob(SEXP netdfSEXP, SEXP start_nodeSEXP, SEXP end_nodeSEXP, SEXP etaSEXP) {
+Rcpp::NumericVector rcpp_router_prob(Rcpp::DataFrame netdf, long long start_node, long long end_node, double eta, bool sparse, std::string solver);
+RcppExport SEXP osmprob_rcpp_router_prob(SEXP netdfSEXP, SEXP start_nodeSEXP, SEXP end_nodeSEXP, SEXP etaSEXP, SEXP sparseSEXP, SEXP solverSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -53,20 +67,208 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< long long >::type start_node(start_nodeSEXP);
     Rcpp::traits::input_parameter< long long >::type end_node(end_nodeSEXP);
     Rcpp::traits::input_parameter< double >::type eta(etaSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_router_prob(netdf, start_node, end_node, eta));
+    Rcpp::traits::input_parameter< bool >::type sparse(sparseSEXP);
+    Rcpp::traits::input_parameter< std::string >::type solver(solverSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_router_prob(netdf, start_node, end_node, eta, sparse, solver));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_prob_engine_create
+SEXP rcpp_prob_engine_create(Rcpp::DataFrame netdf, long long start_node, long long end_node, double eta, bool sparse, std::string solver);
+RcppExport SEXP osmprob_rcpp_prob_engine_create(SEXP netdfSEXP, SEXP start_nodeSEXP, SEXP end_nodeSEXP, SEXP etaSEXP, SEXP sparseSEXP, SEXP solverSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame >::type netdf(netdfSEXP);
+    Rcpp::traits::input_parameter< long long >::type start_node(start_nodeSEXP);
+    Rcpp::traits::input_parameter< long long >::type end_node(end_nodeSEXP);
+    Rcpp::traits::input_parameter< double >::type eta(etaSEXP);
+    Rcpp::traits::input_parameter< bool >::type sparse(sparseSEXP);
+    Rcpp::traits::input_parameter< std::string >::type solver(solverSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_prob_engine_create(netdf, start_node, end_node, eta, sparse, solver));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_prob_engine_route
+Rcpp::NumericVector rcpp_prob_engine_route(SEXP engine, long long start_node, long long end_node);
+RcppExport SEXP osmprob_rcpp_prob_engine_route(SEXP engineSEXP, SEXP start_nodeSEXP, SEXP end_nodeSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< long long >::type start_node(start_nodeSEXP);
+    Rcpp::traits::input_parameter< long long >::type end_node(end_nodeSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_prob_engine_route(engine, start_node, end_node));
     return rcpp_result_gen;
 END_RCPP
 }
-// rcpp_router_dijkstra
-Rcpp::NumericVector rcpp_router_dijkstra(Rcpp::DataFrame netdf, int start_node, int end_node);
-RcppExport SEXP osmprob_rcpp_router_dijkstra(SEXP netdfSEXP, SEXP start_nodeSEXP, SEXP end_nodeSEXP) {
+// rcpp_router_rsp
+Rcpp::List rcpp_router_rsp(Rcpp::DataFrame netdf, std::string start_node, std::string end_node, double eta);
+RcppExport SEXP osmprob_rcpp_router_rsp(SEXP netdfSEXP, SEXP start_nodeSEXP, SEXP end_nodeSEXP, SEXP etaSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::DataFrame >::type netdf(netdfSEXP);
-    Rcpp::traits::input_parameter< int >::type start_node(start_nodeSEXP);
-    Rcpp::traits::input_parameter< int >::type end_node(end_nodeSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_router_dijkstra(netdf, start_node, end_node));
+    Rcpp::traits::input_parameter< std::string >::type start_node(start_nodeSEXP);
+    Rcpp::traits::input_parameter< std::string >::type end_node(end_nodeSEXP);
+    Rcpp::traits::input_parameter< double >::type eta(etaSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_router_rsp(netdf, start_node, end_node, eta));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_router_rsp_sweep
+Rcpp::List rcpp_router_rsp_sweep(Rcpp::DataFrame netdf, std::string start_node, std::string end_node, std::vector <double> eta);
+RcppExport SEXP osmprob_rcpp_router_rsp_sweep(SEXP netdfSEXP, SEXP start_nodeSEXP, SEXP end_nodeSEXP, SEXP etaSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame >::type netdf(netdfSEXP);
+    Rcpp::traits::input_parameter< std::string >::type start_node(start_nodeSEXP);
+    Rcpp::traits::input_parameter< std::string >::type end_node(end_nodeSEXP);
+    Rcpp::traits::input_parameter< std::vector <double> >::type eta(etaSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_router_rsp_sweep(netdf, start_node, end_node, eta));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_router_rsp_flows
+Rcpp::List rcpp_router_rsp_flows(Rcpp::DataFrame netdf, std::vector <std::string> from, std::vector <std::string> to, std::vector <double> weight, double eta);
+RcppExport SEXP osmprob_rcpp_router_rsp_flows(SEXP netdfSEXP, SEXP fromSEXP, SEXP toSEXP, SEXP weightSEXP, SEXP etaSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame >::type netdf(netdfSEXP);
+    Rcpp::traits::input_parameter< std::vector <std::string> >::type from(fromSEXP);
+    Rcpp::traits::input_parameter< std::vector <std::string> >::type to(toSEXP);
+    Rcpp::traits::input_parameter< std::vector <double> >::type weight(weightSEXP);
+    Rcpp::traits::input_parameter< double >::type eta(etaSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_router_rsp_flows(netdf, from, to, weight, eta));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_engine_create
+SEXP rcpp_engine_create(Rcpp::DataFrame netdf);
+RcppExport SEXP osmprob_rcpp_engine_create(SEXP netdfSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame >::type netdf(netdfSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_engine_create(netdf));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_engine_build_ch
+double rcpp_engine_build_ch(SEXP engine);
+RcppExport SEXP osmprob_rcpp_engine_build_ch(SEXP engineSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_engine_build_ch(engine));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_engine_shortest_path
+Rcpp::List rcpp_engine_shortest_path(SEXP engine, std::string start_node, std::string end_node, std::string method);
+RcppExport SEXP osmprob_rcpp_engine_shortest_path(SEXP engineSEXP, SEXP start_nodeSEXP, SEXP end_nodeSEXP, SEXP methodSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< std::string >::type start_node(start_nodeSEXP);
+    Rcpp::traits::input_parameter< std::string >::type end_node(end_nodeSEXP);
+    Rcpp::traits::input_parameter< std::string >::type method(methodSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_engine_shortest_path(engine, start_node, end_node, method));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_engine_distance_matrix
+Rcpp::List rcpp_engine_distance_matrix(SEXP engine, std::vector <std::string> from, std::vector <std::string> to, bool predecessors);
+RcppExport SEXP osmprob_rcpp_engine_distance_matrix(SEXP engineSEXP, SEXP fromSEXP, SEXP toSEXP, SEXP predecessorsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< std::vector <std::string> >::type from(fromSEXP);
+    Rcpp::traits::input_parameter< std::vector <std::string> >::type to(toSEXP);
+    Rcpp::traits::input_parameter< bool >::type predecessors(predecessorsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_engine_distance_matrix(engine, from, to, predecessors));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_engine_map_edges
+void rcpp_engine_map_edges(SEXP engine, Rcpp::NumericVector compact_id, Rcpp::NumericVector map_compact, Rcpp::NumericVector map_original, Rcpp::NumericVector original_id);
+RcppExport SEXP osmprob_rcpp_engine_map_edges(SEXP engineSEXP, SEXP compact_idSEXP, SEXP map_compactSEXP, SEXP map_originalSEXP, SEXP original_idSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type compact_id(compact_idSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type map_compact(map_compactSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type map_original(map_originalSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type original_id(original_idSEXP);
+    rcpp_engine_map_edges(engine, compact_id, map_compact, map_original, original_id);
+    return R_NilValue;
+END_RCPP
+}
+// rcpp_engine_expand_path
+Rcpp::IntegerVector rcpp_engine_expand_path(SEXP engine, std::vector <std::string> path);
+RcppExport SEXP osmprob_rcpp_engine_expand_path(SEXP engineSEXP, SEXP pathSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< std::vector <std::string> >::type path(pathSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_engine_expand_path(engine, path));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_engine_nearest
+Rcpp::List rcpp_engine_nearest(SEXP engine, std::vector <double> lon, std::vector <double> lat, int k);
+RcppExport SEXP osmprob_rcpp_engine_nearest(SEXP engineSEXP, SEXP lonSEXP, SEXP latSEXP, SEXP kSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< SEXP >::type engine(engineSEXP);
+    Rcpp::traits::input_parameter< std::vector <double> >::type lon(lonSEXP);
+    Rcpp::traits::input_parameter< std::vector <double> >::type lat(latSEXP);
+    Rcpp::traits::input_parameter< int >::type k(kSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_engine_nearest(engine, lon, lat, k));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_nearest
+Rcpp::List rcpp_nearest(std::vector <double> vx, std::vector <double> vy, std::vector <double> lon, std::vector <double> lat, int k);
+RcppExport SEXP osmprob_rcpp_nearest(SEXP vxSEXP, SEXP vySEXP, SEXP lonSEXP, SEXP latSEXP, SEXP kSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::vector <double> >::type vx(vxSEXP);
+    Rcpp::traits::input_parameter< std::vector <double> >::type vy(vySEXP);
+    Rcpp::traits::input_parameter< std::vector <double> >::type lon(lonSEXP);
+    Rcpp::traits::input_parameter< std::vector <double> >::type lat(latSEXP);
+    Rcpp::traits::input_parameter< int >::type k(kSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_nearest(vx, vy, lon, lat, k));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_write_snapshot
+void rcpp_write_snapshot(Rcpp::List graphs, std::string file);
+RcppExport SEXP osmprob_rcpp_write_snapshot(SEXP graphsSEXP, SEXP fileSEXP) {
+BEGIN_RCPP
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type graphs(graphsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type file(fileSEXP);
+    rcpp_write_snapshot(graphs, file);
+    return R_NilValue;
+END_RCPP
+}
+// rcpp_read_snapshot
+Rcpp::List rcpp_read_snapshot(std::string file);
+RcppExport SEXP osmprob_rcpp_read_snapshot(SEXP fileSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type file(fileSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_read_snapshot(file));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -0,0 +1,401 @@
+/***************************************************************************
+ *  Project:    osmprob
+ *  File:       ch.h
+ *  Language:   C++
+ *
+ *  Description:    Contraction hierarchies over csr_graph_t. Vertices are
+ *                  contracted in order of edge difference, adding shortcuts
+ *                  wherever a bounded witness search finds no path avoiding
+ *                  the contracted vertex. Queries are bidirectional Dijkstra
+ *                  searches which only ever move upwards in the hierarchy,
+ *                  and shortcuts are unpacked back to edges of the input
+ *                  graph.
+ *
+ *  Compiler Options:   -std=c++11
+ ***************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "graph-csr.h"
+#include "sp-search.h"
+
+struct ch_edge_t
+{
+    vertex_t target;
+    weight_t weight;
+    vertex_t middle; // contracted vertex bypassed by a shortcut, or -1
+};
+
+class contraction_hierarchy_t
+{
+    private:
+        // Settle limit for witness searches. Lower values contract faster at
+        // the cost of some superfluous shortcuts, which never affect results.
+        static const size_t witness_max_settled = 500;
+
+        // Dynamic graph of the uncontracted vertices, holding at most one
+        // edge for each ordered pair of vertices. Edges of each vertex are
+        // moved to the hierarchy lists as it is contracted, as (lower, edge).
+        std::vector <std::vector <ch_edge_t> > out_edges, in_edges;
+        std::vector <std::pair <vertex_t, ch_edge_t> > up_edges, down_edges;
+        std::vector <size_t> deleted_neighbours;
+        std::vector <bool> is_target; // out-neighbours of the vertex contracted
+        sp_workspace_t witness_ws;
+
+        void add_edge (vertex_t u, vertex_t w, weight_t weight,
+                vertex_t middle);
+        void witness_search (vertex_t source, vertex_t skip, weight_t limit,
+                size_t ntargets);
+        size_t contract (vertex_t v, bool simulate);
+        void remove_vertex (vertex_t v);
+        long priority (vertex_t v);
+        void build_search_graphs ();
+        vertex_t find_middle (vertex_t u, vertex_t w) const;
+
+    public:
+        size_t nvertices = 0;
+        size_t nshortcuts = 0;
+        std::vector <size_t> rank; // contraction order of each vertex
+        // up holds edges u -> w with rank [w] > rank [u]; down holds edges
+        // u -> w with rank [u] > rank [w], stored reversed as w -> u, so that
+        // both query directions search upwards.
+        csr_graph_t up, down;
+        std::vector <vertex_t> up_middle, down_middle;
+        sp_workspace_t ws_fwd, ws_bwd;
+
+        void build (const csr_graph_t &g);
+        size_t query (vertex_t source, vertex_t target,
+                std::vector <vertex_t> &path, weight_t &distance);
+};
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                           CONTRACTION                              **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// Insert u -> w, or lower the weight of an existing u -> w edge
+inline void contraction_hierarchy_t::add_edge (vertex_t u, vertex_t w,
+        weight_t weight, vertex_t middle)
+{
+    for (auto &e : out_edges [u])
+        if (e.target == w)
+        {
+            if (weight < e.weight)
+            {
+                e.weight = weight;
+                e.middle = middle;
+                for (auto &f : in_edges [w])
+                    if (f.target == u)
+                    {
+                        f.weight = weight;
+                        f.middle = middle;
+                    }
+            }
+            return;
+        }
+    out_edges [u].push_back ({w, weight, middle});
+    in_edges [w].push_back ({u, weight, middle});
+}
+
+// Dijkstra from source over the remaining graph avoiding skip, stopping
+// once all ntargets flagged in is_target are settled, beyond limit, or after
+// witness_max_settled vertices
+inline void contraction_hierarchy_t::witness_search (vertex_t source,
+        vertex_t skip, weight_t limit, size_t ntargets)
+{
+    witness_ws.next_query ();
+    witness_ws.set (source, 0.0, -1);
+    witness_ws.heap.push (source, 0.0);
+
+    size_t nsettled = 0;
+    while (!witness_ws.heap.empty ())
+    {
+        const weight_t dist = witness_ws.heap.top_key ();
+        if (dist > limit || nsettled++ >= witness_max_settled)
+            break;
+        const vertex_t u = witness_ws.heap.pop ();
+        if (is_target [u] && --ntargets == 0)
+            break;
+        for (const auto &e : out_edges [u])
+        {
+            if (e.target == skip)
+                continue;
+            const weight_t distance_through_u = dist + e.weight;
+            if (distance_through_u < witness_ws.distance (e.target))
+            {
+                witness_ws.set (e.target, distance_through_u, u);
+                witness_ws.heap.push (e.target, distance_through_u);
+            }
+        }
+    }
+    witness_ws.heap.clear ();
+}
+
+// Add the shortcuts needed to remove v from the remaining graph, or just
+// count them if simulate is true
+inline size_t contraction_hierarchy_t::contract (vertex_t v, bool simulate)
+{
+    size_t nshort = 0;
+    const std::vector <ch_edge_t> &vin = in_edges [v], &vout = out_edges [v];
+    for (size_t i = 0; i < vin.size (); i++)
+    {
+        const vertex_t u = vin [i].target;
+        size_t ntargets = 0;
+        weight_t limit = 0.0;
+        for (const auto &e : vout)
+            if (e.target != u)
+            {
+                is_target [e.target] = true;
+                ntargets++;
+                limit = std::max (limit, vin [i].weight + e.weight);
+            }
+        if (ntargets == 0)
+            continue;
+
+        witness_search (u, v, limit, ntargets);
+        for (size_t j = 0; j < vout.size (); j++)
+        {
+            const vertex_t w = vout [j].target;
+            if (w == u)
+                continue;
+            is_target [w] = false;
+            const weight_t via_v = vin [i].weight + vout [j].weight;
+            if (witness_ws.distance (w) > via_v)
+            {
+                nshort++;
+                if (!simulate)
+                    add_edge (u, w, via_v, v);
+            }
+        }
+    }
+    return nshort;
+}
+
+// Edge difference plus the number of already contracted neighbours, which
+// spreads contraction evenly across the graph
+inline long contraction_hierarchy_t::priority (vertex_t v)
+{
+    const long nremoved = (long) (in_edges [v].size () +
+            out_edges [v].size ());
+    return (long) contract (v, true) - nremoved +
+        (long) deleted_neighbours [v];
+}
+
+// Move the edges of v, all of which lead to vertices contracted later, into
+// the hierarchy, and unlink v from the remaining graph
+inline void contraction_hierarchy_t::remove_vertex (vertex_t v)
+{
+    auto unlink = [v] (std::vector <ch_edge_t> &edges) {
+        for (size_t k = 0; k < edges.size (); k++)
+            if (edges [k].target == v)
+            {
+                edges [k] = edges.back ();
+                edges.pop_back ();
+                return;
+            }
+    };
+    for (const auto &e : out_edges [v])
+    {
+        up_edges.push_back (std::make_pair (v, e));
+        unlink (in_edges [e.target]);
+        deleted_neighbours [e.target]++;
+    }
+    for (const auto &e : in_edges [v])
+    {
+        down_edges.push_back (std::make_pair (v, e));
+        unlink (out_edges [e.target]);
+        deleted_neighbours [e.target]++;
+    }
+    std::vector <ch_edge_t> ().swap (out_edges [v]);
+    std::vector <ch_edge_t> ().swap (in_edges [v]);
+}
+
+inline void contraction_hierarchy_t::build (const csr_graph_t &g)
+{
+    nvertices = g.nvertices;
+    out_edges.assign (nvertices, std::vector <ch_edge_t> ());
+    in_edges.assign (nvertices, std::vector <ch_edge_t> ());
+    deleted_neighbours.assign (nvertices, 0);
+    is_target.assign (nvertices, false);
+    rank.assign (nvertices, 0);
+    witness_ws.resize (nvertices);
+    for (size_t u = 0; u < nvertices; u++)
+        for (size_t k = g.offsets [u]; k < g.offsets [u + 1]; k++)
+            if (g.targets [k] != (vertex_t) u)
+                add_edge (u, g.targets [k], g.weights [k], -1);
+
+    // Lazy updates: a popped vertex whose priority has risen above the next
+    // candidate is pushed back rather than contracted
+    dheap_t queue;
+    queue.resize (nvertices);
+    for (size_t v = 0; v < nvertices; v++)
+        queue.push (v, (weight_t) priority (v));
+
+    nshortcuts = 0;
+    size_t next_rank = 0;
+    while (!queue.empty ())
+    {
+        const vertex_t v = queue.pop ();
+        const weight_t p = (weight_t) priority (v);
+        if (!queue.empty () && p > queue.top_key ())
+        {
+            queue.push (v, p);
+            continue;
+        }
+        nshortcuts += contract (v, false);
+        rank [v] = next_rank++;
+        remove_vertex (v);
+    }
+
+    build_search_graphs ();
+
+    std::vector <std::vector <ch_edge_t> > ().swap (out_edges);
+    std::vector <std::vector <ch_edge_t> > ().swap (in_edges);
+    std::vector <std::pair <vertex_t, ch_edge_t> > ().swap (up_edges);
+    std::vector <std::pair <vertex_t, ch_edge_t> > ().swap (down_edges);
+}
+
+inline void contraction_hierarchy_t::build_search_graphs ()
+{
+    // csr_graph_t::build is a stable counting sort, so the middle vertices
+    // are placed by repeating the same pass
+    auto make = [this] (const std::vector <std::pair <vertex_t,
+            ch_edge_t> > &edges, csr_graph_t &gr,
+            std::vector <vertex_t> &middle) {
+        const size_t n = edges.size ();
+        std::vector <vertex_t> from (n), to (n);
+        std::vector <weight_t> w (n);
+        for (size_t i = 0; i < n; i++)
+        {
+            from [i] = edges [i].first;
+            to [i] = edges [i].second.target;
+            w [i] = edges [i].second.weight;
+        }
+        gr.build (from, to, w, nvertices);
+        std::vector <size_t> pos (gr.offsets.begin (), gr.offsets.end () - 1);
+        middle.resize (n);
+        for (size_t i = 0; i < n; i++)
+            middle [pos [from [i]]++] = edges [i].second.middle;
+    };
+    make (up_edges, up, up_middle);
+    make (down_edges, down, down_middle);
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                              QUERY                                 **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// Middle vertex of the hierarchy edge u -> w, which must exist
+inline vertex_t contraction_hierarchy_t::find_middle (vertex_t u,
+        vertex_t w) const
+{
+    if (rank [w] > rank [u])
+    {
+        for (size_t k = up.offsets [u]; k < up.offsets [u + 1]; k++)
+            if (up.targets [k] == w)
+                return up_middle [k];
+    } else
+    {
+        for (size_t k = down.offsets [w]; k < down.offsets [w + 1]; k++)
+            if (down.targets [k] == u)
+                return down_middle [k];
+    }
+    return -1;
+}
+
+// Shortest path from source to target as vertices of the input graph, which
+// is left empty (with distance = max_weight) if target is unreachable.
+// Returns the number of vertices settled over both directions.
+inline size_t contraction_hierarchy_t::query (vertex_t source,
+        vertex_t target, std::vector <vertex_t> &path, weight_t &distance)
+{
+    ws_fwd.resize (nvertices);
+    ws_bwd.resize (nvertices);
+    ws_fwd.next_query ();
+    ws_bwd.next_query ();
+    ws_fwd.set (source, 0.0, -1);
+    ws_fwd.heap.push (source, 0.0);
+    ws_bwd.set (target, 0.0, -1);
+    ws_bwd.heap.push (target, 0.0);
+
+    distance = max_weight;
+    vertex_t meet = -1;
+    size_t nsettled = 0;
+    while (!ws_fwd.heap.empty () || !ws_bwd.heap.empty ())
+    {
+        // Advance the side with the smaller key; each side stops on its own
+        // once its minimum reaches the best distance found so far
+        const bool forward = !ws_fwd.heap.empty () && (ws_bwd.heap.empty () ||
+                ws_fwd.heap.top_key () <= ws_bwd.heap.top_key ());
+        sp_workspace_t &ws = forward ? ws_fwd : ws_bwd;
+        const sp_workspace_t &ws_other = forward ? ws_bwd : ws_fwd;
+        const csr_graph_t &gr = forward ? up : down;
+
+        const weight_t dist = ws.heap.top_key ();
+        if (dist >= distance)
+        {
+            ws.heap.clear ();
+            continue;
+        }
+        const vertex_t u = ws.heap.pop ();
+        nsettled++;
+        if (ws_other.reached (u) && dist + ws_other.distance (u) < distance)
+        {
+            distance = dist + ws_other.distance (u);
+            meet = u;
+        }
+
+        for (size_t k = gr.offsets [u]; k < gr.offsets [u + 1]; k++)
+        {
+            const vertex_t v = gr.targets [k];
+            const weight_t distance_through_u = dist + gr.weights [k];
+            if (distance_through_u < ws.distance (v))
+            {
+                ws.set (v, distance_through_u, u);
+                ws.heap.push (v, distance_through_u);
+            }
+        }
+    }
+
+    path.clear ();
+    if (meet == -1)
+        return nsettled;
+
+    // Hierarchy edges along source -> meet -> target, each then unpacked
+    // depth-first into edges of the input graph
+    std::vector <vertex_t> hpath = ws_fwd.path_to (meet);
+    for (vertex_t v = ws_bwd.previous (meet); v != -1;
+            v = ws_bwd.previous (v))
+        hpath.push_back (v);
+
+    path.push_back (source);
+    std::vector <std::pair <vertex_t, vertex_t> > stack;
+    for (size_t i = hpath.size () - 1; i > 0; i--)
+        stack.push_back (std::make_pair (hpath [i - 1], hpath [i]));
+    while (!stack.empty ())
+    {
+        const std::pair <vertex_t, vertex_t> e = stack.back ();
+        stack.pop_back ();
+        const vertex_t mid = find_middle (e.first, e.second);
+        if (mid == -1)
+            path.push_back (e.second);
+        else
+        {
+            stack.push_back (std::make_pair (mid, e.second));
+            stack.push_back (std::make_pair (e.first, mid));
+        }
+    }
+
+    return nsettled;
+}
@@ -0,0 +1,454 @@
+/***************************************************************************
+ *  Project:    osmprob
+ *  File:       csr-mat.h
+ *  Language:   C++
+ *
+ *  Description:    Compressed sparse row matrices and iterative solvers for
+ *                  the sparse execution mode of the probabilistic router.
+ *                  Kept free of Rcpp/Armadillo types so the numerics operate
+ *                  directly on contiguous arrays.
+ *
+ *  Compiler Options:   -std=c++11
+ ***************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <stdexcept>
+
+// Square sparse matrix in CSR format. Column indices within a row need not be
+// sorted, but each (row, col) pair appears at most once.
+struct csr_mat_t
+{
+    size_t nrows = 0;
+    std::vector <size_t> row_ptr; // nrows + 1 offsets into col / val
+    std::vector <size_t> col;
+    std::vector <double> val;
+
+    size_t nnz () const { return val.size (); }
+
+    // Value at (i, j), or zero if not stored
+    double get (size_t i, size_t j) const
+    {
+        for (size_t k = row_ptr [i]; k < row_ptr [i + 1]; k++)
+            if (col [k] == j)
+                return val [k];
+        return 0.0;
+    }
+
+    // y = A x
+    void multiply (const double *x, double *y) const
+    {
+        for (size_t i = 0; i < nrows; i++)
+        {
+            double s = 0.0;
+            for (size_t k = row_ptr [i]; k < row_ptr [i + 1]; k++)
+                s += val [k] * x [col [k]];
+            y [i] = s;
+        }
+    }
+};
+
+// Return (I - A) for square A, merging any existing diagonal entries
+inline csr_mat_t identity_minus (const csr_mat_t &a)
+{
+    csr_mat_t res;
+    res.nrows = a.nrows;
+    res.row_ptr.resize (a.nrows + 1, 0);
+    res.col.reserve (a.nnz () + a.nrows);
+    res.val.reserve (a.nnz () + a.nrows);
+    for (size_t i = 0; i < a.nrows; i++)
+    {
+        res.col.push_back (i);
+        res.val.push_back (1.0);
+        const size_t diag = res.val.size () - 1;
+        for (size_t k = a.row_ptr [i]; k < a.row_ptr [i + 1]; k++)
+        {
+            if (a.col [k] == i)
+                res.val [diag] -= a.val [k];
+            else
+            {
+                res.col.push_back (a.col [k]);
+                res.val.push_back (-a.val [k]);
+            }
+        }
+        res.row_ptr [i + 1] = res.val.size ();
+    }
+    return res;
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                          BOLTZMANN_UPDATE                          **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// One iteration of the transition probabilities held in q: each stored entry
+// which is still positive becomes the Boltzmann weight exp (-eta_inv (q_ij +
+// v_j) + x_j), and each row is then normalised to unit sum, or zeroed if it
+// sums to zero. Zeros remain zero, as exp (-Inf) of the dense formulation, so
+// the cost scales with the number of stored entries. New values are written
+// to next, and the summed absolute change is returned. Rows are independent
+// and run in parallel, each with SIMD loops for the exponentials and for the
+// normalisation.
+inline double boltzmann_update (const csr_mat_t &q, const double *x,
+        const double *v, double eta_inv, std::vector <double> &next)
+{
+    next.resize (q.nnz ());
+    double delta = 0.0;
+    // signed loop index for OpenMP 2.0
+    #pragma omp parallel for schedule (static) reduction (+:delta)
+    for (long i = 0; i < (long) q.nrows; i++)
+    {
+        const size_t k0 = q.row_ptr [i], m = q.row_ptr [i + 1] - k0;
+        const double *qi = q.val.data () + k0;
+        const size_t *ci = q.col.data () + k0;
+        double *wi = next.data () + k0;
+
+        double rsum = 0.0;
+        #pragma omp simd reduction (+:rsum)
+        for (size_t k = 0; k < m; k++)
+        {
+            const double w = std::exp (-eta_inv * (qi [k] + v [ci [k]]) +
+                    x [ci [k]]);
+            wi [k] = (qi [k] > 0.0) ? w : 0.0;
+            rsum += wi [k];
+        }
+
+        double di = 0.0;
+        #pragma omp simd reduction (+:di)
+        for (size_t k = 0; k < m; k++)
+        {
+            wi [k] = (rsum > 0.0) ? wi [k] / rsum : 0.0;
+            di += std::fabs (wi [k] - qi [k]);
+        }
+        delta += di;
+    }
+    return delta;
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                              BICGSTAB                              **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// Vectors of bicgstab, which retain their storage between solves
+struct bicgstab_workspace_t
+{
+    std::vector <double> r, rhat, p, v, s, t;
+};
+
+// Solve A x = b with BiCGSTAB, using the contents of x as the initial guess.
+// Returns the number of iterations, or max_iter + 1 if not converged.
+inline unsigned bicgstab (const csr_mat_t &a, const double *b, double *x,
+        double tol, unsigned max_iter, bicgstab_workspace_t &ws)
+{
+    const size_t n = a.nrows;
+    std::vector <double> &r = ws.r, &rhat = ws.rhat, &p = ws.p, &v = ws.v,
+        &s = ws.s, &t = ws.t;
+    r.resize (n);
+    s.resize (n);
+    t.resize (n);
+    p.assign (n, 0.0);
+    v.assign (n, 0.0);
+
+    auto dot = [n] (const std::vector <double> &u,
+            const std::vector <double> &w) {
+        double res = 0.0;
+        for (size_t i = 0; i < n; i++)
+            res += u [i] * w [i];
+        return res;
+    };
+
+    double bnorm = 0.0;
+    for (size_t i = 0; i < n; i++)
+        bnorm += b [i] * b [i];
+    bnorm = std::sqrt (bnorm);
+    if (bnorm == 0.0)
+    {
+        std::fill (x, x + n, 0.0);
+        return 0;
+    }
+
+    a.multiply (x, &r [0]);
+    for (size_t i = 0; i < n; i++)
+        r [i] = b [i] - r [i];
+    rhat = r;
+    if (std::sqrt (dot (r, r)) <= tol * bnorm)
+        return 0;
+
+    double rho = 1.0, alpha = 1.0, omega = 1.0;
+    for (unsigned iter = 1; iter <= max_iter; iter++)
+    {
+        const double rho_new = dot (rhat, r);
+        if (rho_new == 0.0)
+            return max_iter + 1;
+        const double beta = (rho_new / rho) * (alpha / omega);
+        for (size_t i = 0; i < n; i++)
+            p [i] = r [i] + beta * (p [i] - omega * v [i]);
+        a.multiply (&p [0], &v [0]);
+        alpha = rho_new / dot (rhat, v);
+        for (size_t i = 0; i < n; i++)
+            s [i] = r [i] - alpha * v [i];
+        if (std::sqrt (dot (s, s)) <= tol * bnorm)
+        {
+            for (size_t i = 0; i < n; i++)
+                x [i] += alpha * p [i];
+            return iter;
+        }
+        a.multiply (&s [0], &t [0]);
+        const double tt = dot (t, t);
+        omega = (tt > 0.0) ? dot (t, s) / tt : 0.0;
+        for (size_t i = 0; i < n; i++)
+        {
+            x [i] += alpha * p [i] + omega * s [i];
+            r [i] = s [i] - omega * t [i];
+        }
+        if (std::sqrt (dot (r, r)) <= tol * bnorm)
+            return iter;
+        if (omega == 0.0)
+            return max_iter + 1;
+        rho = rho_new;
+    }
+    return max_iter + 1;
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                             SPARSE_LU                              **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// Envelope (skyline) LU factorisation without pivoting, applied after a
+// reverse Cuthill-McKee reordering of the symmetrised sparsity pattern. Fill
+// is confined to the envelope, so storage is O(n * bandwidth) rather than
+// O(n^2). (I - Q) is a non-singular M-matrix whenever every vertex can reach
+// the absorbing end node, for which elimination without pivoting is stable.
+// The ordering and envelope depend only on the sparsity pattern, so matrices
+// which share a pattern are analysed once, and then each only refactorised.
+// A zero pivot throws singular_matrix_error, which callers may distinguish
+// from other failures.
+struct singular_matrix_error : public std::runtime_error
+{
+    explicit singular_matrix_error (const std::string &what)
+        : std::runtime_error (what) {}
+};
+
+struct sparse_lu_t
+{
+    size_t n = 0;
+    std::vector <size_t> perm, inv; // perm [new] = old, inv [old] = new
+    std::vector <size_t> first; // first column of the envelope in each row
+    std::vector <size_t> lptr, uptr; // offsets of L rows and U columns
+    std::vector <double> lval, uval;
+
+    // Symbolic phase: ordering and envelope of the pattern of a
+    void analyse (const csr_mat_t &a);
+    // Numeric phase, for a of the same pattern as last analysed
+    void refactorise (const csr_mat_t &a);
+    void factorise (const csr_mat_t &a) { analyse (a); refactorise (a); }
+    // z is workspace, resized to n
+    void solve (const double *b, double *x, std::vector <double> &z) const;
+    // Solve A' x = b with the same factors
+    void solve_transposed (const double *b, double *x,
+            std::vector <double> &z) const;
+};
+
+// Reverse Cuthill-McKee ordering of the pattern of (A + A^T)
+inline std::vector <size_t> rcm_order (const csr_mat_t &a)
+{
+    const size_t n = a.nrows;
+    std::vector <size_t> deg (n, 0);
+    for (size_t i = 0; i < n; i++)
+        for (size_t k = a.row_ptr [i]; k < a.row_ptr [i + 1]; k++)
+            if (a.col [k] != i)
+            {
+                deg [i]++;
+                deg [a.col [k]]++;
+            }
+    std::vector <size_t> ptr (n + 1, 0);
+    for (size_t i = 0; i < n; i++)
+        ptr [i + 1] = ptr [i] + deg [i];
+    std::vector <size_t> nbs (ptr [n]), pos (ptr.begin (), ptr.end () - 1);
+    for (size_t i = 0; i < n; i++)
+        for (size_t k = a.row_ptr [i]; k < a.row_ptr [i + 1]; k++)
+            if (a.col [k] != i)
+            {
+                nbs [pos [i]++] = a.col [k];
+                nbs [pos [a.col [k]]++] = i;
+            }
+
+    std::vector <size_t> by_degree (n);
+    for (size_t i = 0; i < n; i++)
+        by_degree [i] = i;
+    std::stable_sort (by_degree.begin (), by_degree.end (),
+            [&deg] (size_t u, size_t v) { return deg [u] < deg [v]; });
+
+    std::vector <size_t> order;
+    order.reserve (n);
+    std::vector <bool> visited (n, false);
+    for (size_t s : by_degree)
+    {
+        if (visited [s])
+            continue;
+        visited [s] = true;
+        size_t head = order.size ();
+        order.push_back (s);
+        while (head < order.size ())
+        {
+            const size_t u = order [head++];
+            const size_t tail = order.size ();
+            for (size_t k = ptr [u]; k < ptr [u + 1]; k++)
+                if (!visited [nbs [k]])
+                {
+                    visited [nbs [k]] = true;
+                    order.push_back (nbs [k]);
+                }
+            std::stable_sort (order.begin () + tail, order.end (),
+                    [&deg] (size_t u, size_t v) { return deg [u] < deg [v]; });
+        }
+    }
+    std::reverse (order.begin (), order.end ());
+    return order;
+}
+
+inline void sparse_lu_t::analyse (const csr_mat_t &a)
+{
+    n = a.nrows;
+    perm = rcm_order (a);
+    inv.resize (n);
+    for (size_t i = 0; i < n; i++)
+        inv [perm [i]] = i;
+
+    // Envelope of the symmetrised pattern in the new ordering
+    first.resize (n);
+    for (size_t i = 0; i < n; i++)
+        first [i] = i;
+    for (size_t i = 0; i < n; i++)
+        for (size_t k = a.row_ptr [i]; k < a.row_ptr [i + 1]; k++)
+        {
+            const size_t r = inv [i], c = inv [a.col [k]];
+            if (c < r)
+                first [r] = std::min (first [r], c);
+            else
+                first [c] = std::min (first [c], r);
+        }
+
+    lptr.resize (n + 1);
+    uptr.resize (n + 1);
+    lptr [0] = uptr [0] = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        lptr [i + 1] = lptr [i] + i - first [i];
+        uptr [i + 1] = uptr [i] + i - first [i] + 1;
+    }
+}
+
+inline void sparse_lu_t::refactorise (const csr_mat_t &a)
+{
+    if (a.nrows != n)
+        throw std::runtime_error ("matrix does not match its LU analysis");
+    lval.assign (lptr [n], 0.0);
+    uval.assign (uptr [n], 0.0);
+
+    // Scatter A: lower entries into L rows, upper (and diagonal) into U cols
+    for (size_t i = 0; i < n; i++)
+        for (size_t k = a.row_ptr [i]; k < a.row_ptr [i + 1]; k++)
+        {
+            const size_t r = inv [i], c = inv [a.col [k]];
+            if (c < r)
+                lval [lptr [r] + c - first [r]] = a.val [k];
+            else
+                uval [uptr [c] + r - first [c]] = a.val [k];
+        }
+
+    // Doolittle elimination within the envelope: for each k, first column k
+    // of U above the diagonal, then row k of L, then the pivot u_kk. Offsets
+    // are shifted by first [] so that, e.g., uval [uk + i] = u_ik (unsigned
+    // wrap-around in the shift is well defined and cancels on indexing).
+    for (size_t k = 0; k < n; k++)
+    {
+        const size_t uk = uptr [k] - first [k], lk = lptr [k] - first [k];
+        for (size_t i = first [k]; i < k; i++)
+        {
+            const size_t li = lptr [i] - first [i];
+            double s = 0.0;
+            for (size_t m = std::max (first [i], first [k]); m < i; m++)
+                s += lval [li + m] * uval [uk + m];
+            uval [uk + i] -= s;
+        }
+        for (size_t j = first [k]; j < k; j++)
+        {
+            const size_t uj = uptr [j] - first [j];
+            double s = 0.0;
+            for (size_t m = std::max (first [j], first [k]); m < j; m++)
+                s += lval [lk + m] * uval [uj + m];
+            lval [lk + j] = (lval [lk + j] - s) / uval [uj + j];
+        }
+        double s = 0.0;
+        for (size_t m = first [k]; m < k; m++)
+            s += lval [lk + m] * uval [uk + m];
+        uval [uk + k] -= s;
+        if (!(std::fabs (uval [uk + k]) > 1.0e-14))
+            throw singular_matrix_error ("(I - Q) is singular");
+    }
+}
+
+inline void sparse_lu_t::solve (const double *b, double *x,
+        std::vector <double> &z) const
+{
+    z.resize (n);
+    for (size_t k = 0; k < n; k++)
+    {
+        const size_t lk = lptr [k] - first [k];
+        double s = b [perm [k]];
+        for (size_t j = first [k]; j < k; j++)
+            s -= lval [lk + j] * z [j];
+        z [k] = s;
+    }
+    for (size_t k = n; k-- > 0; )
+    {
+        const size_t uk = uptr [k] - first [k];
+        z [k] /= uval [uk + k];
+        for (size_t i = first [k]; i < k; i++)
+            z [i] -= uval [uk + i] * z [k];
+    }
+    for (size_t k = 0; k < n; k++)
+        x [perm [k]] = z [k];
+}
+
+// With B = L U the reordered A, A' x = b is B' z = U' L' z = b reordered, for
+// which U' is lower triangular with its rows held as the columns of U, and L'
+// is unit upper triangular with its columns held as the rows of L.
+inline void sparse_lu_t::solve_transposed (const double *b, double *x,
+        std::vector <double> &z) const
+{
+    z.resize (n);
+    for (size_t k = 0; k < n; k++)
+    {
+        const size_t uk = uptr [k] - first [k];
+        double s = b [perm [k]];
+        for (size_t i = first [k]; i < k; i++)
+            s -= uval [uk + i] * z [i];
+        z [k] = s / uval [uk + k];
+    }
+    for (size_t k = n; k-- > 0; )
+    {
+        const size_t lk = lptr [k] - first [k];
+        for (size_t j = first [k]; j < k; j++)
+            z [j] -= lval [lk + j] * z [k];
+    }
+    for (size_t k = 0; k < n; k++)
+        x [perm [k]] = z [k];
+}
@@ -0,0 +1,81 @@
+/***************************************************************************
+ *  Project:    osmprob
+ *  File:       graph-csr.h
+ *  Language:   C++
+ *
+ *  Description:    Compressed sparse row graph used by all routing entry
+ *                  points. Out-edges of each vertex are held contiguously in
+ *                  flat target and weight arrays, indexed through offsets.
+ *
+ *  Compiler Options:   -std=c++11
+ ***************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <stdexcept>
+#include <cstddef>
+
+typedef long long vertex_t;
+typedef double weight_t;
+
+const weight_t max_weight = std::numeric_limits <weight_t>::infinity();
+
+struct csr_graph_t
+{
+    size_t nvertices = 0;
+    std::vector <size_t> offsets; // edges of v: [offsets [v], offsets [v + 1])
+    std::vector <vertex_t> targets;
+    std::vector <weight_t> weights;
+
+    size_t degree (vertex_t v) const
+    {
+        return offsets [v + 1] - offsets [v];
+    }
+
+    // Build by a counting sort over the edge list, so edges of each vertex
+    // retain their input order. Vertices are indexed directly by ID, and
+    // must lie within [0, nv).
+    void build (const std::vector <vertex_t> &from,
+            const std::vector <vertex_t> &to,
+            const std::vector <weight_t> &w, size_t nv)
+    {
+        nvertices = nv;
+        offsets.assign (nv + 1, 0);
+        for (size_t i = 0; i < from.size (); i++)
+        {
+            if (from [i] < 0 || to [i] < 0 || (size_t) from [i] >= nv ||
+                    (size_t) to [i] >= nv)
+                throw std::runtime_error ("vertex index out of range");
+            offsets [from [i] + 1]++;
+        }
+        for (size_t v = 0; v < nv; v++)
+            offsets [v + 1] += offsets [v];
+
+        targets.resize (from.size ());
+        weights.resize (from.size ());
+        std::vector <size_t> pos (offsets.begin (), offsets.end () - 1);
+        for (size_t i = 0; i < from.size (); i++)
+        {
+            const size_t k = pos [from [i]]++;
+            targets [k] = to [i];
+            weights [k] = w [i];
+        }
+    }
+
+    // Graph with every edge reversed, for backward searches
+    csr_graph_t reversed () const
+    {
+        std::vector <vertex_t> from (targets.size ()), to (targets.size ());
+        for (size_t v = 0; v < nvertices; v++)
+            for (size_t k = offsets [v]; k < offsets [v + 1]; k++)
+            {
+                from [k] = targets [k];
+                to [k] = (vertex_t) v;
+            }
+        csr_graph_t res;
+        res.build (from, to, weights, nvertices);
+        return res;
+    }
+};
@@ -2,32 +2,39 @@
 #include <algorithm>
 #include <vector>
 #include <map>
+#include <unordered_map>
 
 typedef std::string osm_id_t;
 typedef int osm_edge_id_t;
+// OSM IDs are interned in graph_from_df to dense indices, assigned in sorted
+// order of the IDs, on which all compaction then runs; the strings are only
+// restored for the output data.frames.
+typedef unsigned int vertex_id_t;
+const vertex_id_t no_vertex = static_cast <vertex_id_t> (-1);
 
 struct osm_vertex_t
 {
     private:
-        std::set <osm_id_t> in, out;
+        std::set <vertex_id_t> in, out;
         double lat, lon;
 
     public:
-        void add_neighbour_in (osm_id_t osm_id) { in.insert (osm_id); }
-        void add_neighbour_out (osm_id_t osm_id) { out.insert (osm_id); }
+        bool in_graph = true; // false once removed with a small component
+        void add_neighbour_in (vertex_id_t id) { in.insert (id); }
+        void add_neighbour_out (vertex_id_t id) { out.insert (id); }
         int get_degree_in () { return in.size (); }
         int get_degree_out () { return out.size (); }
         void set_lat (double lat) { this -> lat = lat; }
         void set_lon (double lon) { this -> lon = lon; }
-        double getLat () { return lat; }
-        double getLon () { return lon; }
-        std::set <osm_id_t> get_all_neighbours ()
+        double getLat () const { return lat; }
+        double getLon () const { return lon; }
+        std::set <vertex_id_t> get_all_neighbours ()
         {
-            std::set <osm_id_t> all_neighbours = in;
+            std::set <vertex_id_t> all_neighbours = in;
             all_neighbours.insert (out.begin (), out.end ());
             return all_neighbours;
         }
-        void replace_neighbour (osm_id_t n_old, osm_id_t n_new)
+        void replace_neighbour (vertex_id_t n_old, vertex_id_t n_new)
         {
             if (in.find (n_old) != in.end ())
             {
@@ -55,9 +62,8 @@ struct osm_vertex_t
 struct osm_edge_t
 {
     private:
-        osm_id_t from, to;
+        vertex_id_t from, to;
         osm_edge_id_t id;
-        std::set <int> replacing_edges;
         bool in_original_graph;
 
     public:
@@ -65,14 +71,13 @@ struct osm_edge_t
         float weight;
         bool replaced_by_compact = false;
         std::string highway;
-        osm_id_t get_from_vertex () { return from; }
-        osm_id_t getToVertex () { return to; }
+        vertex_id_t get_from_vertex () { return from; }
+        vertex_id_t getToVertex () { return to; }
         osm_edge_id_t getID () { return id; }
-        std::set <int> is_replacement_for () { return replacing_edges; }
         bool in_original () { return in_original_graph; }
 
-        osm_edge_t (osm_id_t from_id, osm_id_t to_id, float dist, float weight,
-                   std::string highway, int id, std::set <int> is_rep_for,
+        osm_edge_t (vertex_id_t from_id, vertex_id_t to_id, float dist,
+                   float weight, std::string highway, int id,
                    bool in_original)
         {
             this -> to = to_id;
@@ -81,18 +86,48 @@ struct osm_edge_t
             this -> weight = weight;
             this -> highway = highway;
             this -> id = id;
-            this -> replacing_edges.insert (is_rep_for.begin (),
-                    is_rep_for.end ());
             this -> in_original_graph = in_original;
         }
 };
 
-typedef std::map <osm_id_t, osm_vertex_t> vertex_map;
+typedef std::vector <osm_vertex_t> vertex_vector; // indexed by vertex_id_t
 typedef std::vector <osm_edge_t> edge_vector;
-typedef std::map <int, std::set <int>> replacement_map;
 int edge_ids = 1;
 
-void graph_from_df (Rcpp::DataFrame gr, vertex_map &vm, edge_vector &e)
+// Each replaced edge points to the edge that replaced it, and replacing
+// edges always have higher IDs than those they replace. The compact edge
+// corresponding to any original edge is thus the root of its chain of
+// replacements, which is found with path compression.
+struct replacement_map
+{
+    private:
+        std::vector <osm_edge_id_t> replaced_by; // 0 if not replaced
+
+    public:
+        void set (osm_edge_id_t id, osm_edge_id_t by)
+        {
+            if (replaced_by.size () <= (size_t) std::max (id, by))
+                replaced_by.resize (std::max (id, by) + 1, 0);
+            replaced_by [id] = by;
+        }
+        osm_edge_id_t get_compact_edge (osm_edge_id_t id)
+        {
+            osm_edge_id_t root = id;
+            while ((size_t) root < replaced_by.size () &&
+                    replaced_by [root] != 0)
+                root = replaced_by [root];
+            while (id != root)
+            {
+                osm_edge_id_t next = replaced_by [id];
+                replaced_by [id] = root;
+                id = next;
+            }
+            return root;
+        }
+};
+
+void graph_from_df (Rcpp::DataFrame gr, vertex_vector &vm, edge_vector &e,
+        std::vector <osm_id_t> &ids)
 {
     edge_ids = 1;
     Rcpp::StringVector from = gr ["from_id"];
@@ -105,142 +140,193 @@ void graph_from_df (Rcpp::DataFrame gr, vertex_map &vm, edge_vector &e)
     Rcpp::NumericVector weight = gr ["d_weighted"];
     Rcpp::StringVector hw = gr ["highway"];
 
+    ids.clear ();
+    ids.reserve (2 * to.length ());
     for (int i = 0; i < to.length (); i ++)
     {
-        osm_id_t from_id = std::string (from [i]);
-        osm_id_t to_id = std::string (to [i]);
+        ids.push_back (std::string (from [i]));
+        ids.push_back (std::string (to [i]));
+    }
+    std::sort (ids.begin (), ids.end ());
+    ids.erase (std::unique (ids.begin (), ids.end ()), ids.end ());
+    std::unordered_map <osm_id_t, vertex_id_t> index;
+    index.reserve (ids.size ());
+    for (vertex_id_t i = 0; i < ids.size (); i ++)
+        index.emplace (ids [i], i);
+
+    // Coordinates are taken from the first edge on which each vertex appears
+    vm.assign (ids.size (), osm_vertex_t ());
+    std::vector <bool> seen (ids.size (), false);
+    for (int i = 0; i < to.length (); i ++)
+    {
+        const vertex_id_t from_id = index.at (std::string (from [i]));
+        const vertex_id_t to_id = index.at (std::string (to [i]));
 
-        if (vm.find (from_id) == vm.end ())
+        if (!seen [from_id])
         {
-            osm_vertex_t fromV = osm_vertex_t ();
-            fromV.set_lat (from_lat [i]);
-            fromV.set_lon (from_lon [i]);
-            vm.insert (std::make_pair(from_id, fromV));
+            vm [from_id].set_lat (from_lat [i]);
+            vm [from_id].set_lon (from_lon [i]);
+            seen [from_id] = true;
         }
-        osm_vertex_t from_vtx = vm.at (from_id);
-        from_vtx.add_neighbour_out (to_id);
-        vm [from_id] = from_vtx;
+        vm [from_id].add_neighbour_out (to_id);
 
-        if (vm.find (to_id) == vm.end ())
+        if (!seen [to_id])
         {
-            osm_vertex_t toV = osm_vertex_t ();
-            toV.set_lat (to_lat [i]);
-            toV.set_lon (to_lon [i]);
-            vm.insert (std::make_pair(to_id, toV));
+            vm [to_id].set_lat (to_lat [i]);
+            vm [to_id].set_lon (to_lon [i]);
+            seen [to_id] = true;
         }
-        osm_vertex_t to_vtx = vm.at (to_id);
-        to_vtx.add_neighbour_in (from_id);
-        vm [to_id] = to_vtx;
+        vm [to_id].add_neighbour_in (from_id);
 
-        std::set <int> replacementEdges;
         osm_edge_t edge = osm_edge_t (from_id, to_id, dist [i], weight [i],
-                std::string (hw [i]), edge_ids ++, replacementEdges, true);
+                std::string (hw [i]), edge_ids ++, true);
         e.push_back (edge);
     }
 }
 
-void get_largest_graph_component (vertex_map &v, std::map <osm_id_t, int> &com,
-        int &largest_id)
+vertex_id_t find_component_root (std::vector <vertex_id_t> &parent,
+        vertex_id_t i)
+{
+    while (parent [i] != i)
+    {
+        parent [i] = parent [parent [i]]; // path halving
+        i = parent [i];
+    }
+    return i;
+}
+
+// Labels the weakly connected components of the graph with union-find in
+// O(V + E). com [i] is the component of vertex i, numbered consecutively in
+// the order in which a vertex-by-vertex scan first discovers and then merges
+// them (ties in size below are resolved in favour of the lower number), and
+// com_size holds the number of vertices in each component.
+void get_graph_components (vertex_vector &v, std::vector <int> &com,
+        std::vector <int> &com_size)
 {
+    const vertex_id_t n = v.size ();
+    std::vector <vertex_id_t> parent (n), rank (n, 0);
+    for (vertex_id_t i = 0; i < n; i ++)
+        parent [i] = i;
+    // Each set carries the highest label of the components merged into it
+    std::vector <int> label (n, -1);
     int component_number = 0;
-    // initialize components map
-    for (auto it = v.begin (); it != v.end (); ++ it)
-        com.insert (std::make_pair (it -> first, -1));
 
-    for (auto it = v.begin (); it != v.end (); ++ it)
+    for (vertex_id_t vtxId = 0; vtxId < n; vtxId ++)
     {
-        std::set <int> comps;
-        osm_id_t vtxId = it -> first;
-        osm_vertex_t vtx = it -> second;
-        std::set <osm_id_t> neighbors = vtx.get_all_neighbours ();
-        comps.insert (com.at (vtxId));
-        for (auto n:neighbors)
-            comps.insert (com.at (n));
-        int largest_comp_num = *comps.rbegin ();
-        if (largest_comp_num == -1)
-            largest_comp_num = component_number ++;
-        com.at (vtxId) = largest_comp_num;
-        for (auto n:neighbors)
-            com.at (n) = largest_comp_num;
-        for (auto c = com.begin (); c != com.end (); ++ c)
+        std::set <vertex_id_t> neighbors = v [vtxId].get_all_neighbours ();
+        vertex_id_t root = find_component_root (parent, vtxId);
+        int largest_comp_num = label [root];
+        for (auto nb:neighbors)
         {
-            osm_id_t cOsm = c -> first;
-            int cNum = c -> second;
-            if (comps.find (cNum) != comps.end () && cNum != -1)
-                com.at (cOsm) = largest_comp_num;
+            vertex_id_t nroot = find_component_root (parent, nb);
+            largest_comp_num = std::max (largest_comp_num, label [nroot]);
+            if (nroot == root)
+                continue;
+            if (rank [nroot] > rank [root])
+                std::swap (root, nroot);
+            parent [nroot] = root;
+            if (rank [nroot] == rank [root])
+                rank [root] ++;
         }
+        if (largest_comp_num == -1)
+            largest_comp_num = component_number ++;
+        label [root] = largest_comp_num;
     }
 
-    std::set <int> unique_components;
-    for (auto c:com)
-        unique_components.insert (c.second);
-
-    int largest_component_value = -1;
-    std::map <int, int> component_size;
-    for (auto uc:unique_components)
+    // Renumber the surviving labels consecutively, preserving their order
+    std::vector <int> renumber (component_number, -1);
+    com.resize (n);
+    for (vertex_id_t i = 0; i < n; i ++)
     {
-        int com_size = 0;
-        for (auto c:com)
-        {
-            if (c.second == uc)
-                com_size ++;
-        }
-        if (com_size > largest_component_value)
-        {
-            largest_component_value = com_size;
-            largest_id = uc;
-        }
-        component_size.insert (std::make_pair (uc, com_size));
+        com [i] = label [find_component_root (parent, i)];
+        renumber [com [i]] = 0;
+    }
+    int ncomponents = 0;
+    for (auto &r:renumber)
+        if (r == 0)
+            r = ncomponents ++;
+    com_size.assign (ncomponents, 0);
+    for (auto &c:com)
+    {
+        c = renumber [c];
+        com_size [c] ++;
     }
 }
 
-void remove_small_graph_components (vertex_map &v, edge_vector &e,
-        std::map <osm_id_t, int> &components, int &largest_num)
+// Flags the components to be retained: the n_components largest ones, along
+// with any others of at least min_size vertices (when min_size > 0).
+std::vector <bool> select_graph_components (const std::vector <int> &com_size,
+        int n_components, int min_size)
 {
-    for (auto comp = components.begin (); comp != components.end (); comp ++)
-        if (comp -> second != largest_num)
-            v.erase (comp -> first);
-    auto eIt = e.begin ();
-    while (eIt != e.end ())
-    {
-        osm_id_t fId = eIt -> get_from_vertex ();
-        if (v.find (fId) == v.end ())
-            eIt = e.erase (eIt);
-        else
-            eIt ++;
-    }
+    std::vector <int> order (com_size.size ());
+    for (size_t i = 0; i < order.size (); i ++)
+        order [i] = i;
+    std::stable_sort (order.begin (), order.end (),
+            [&com_size] (int a, int b) {
+                return com_size [a] > com_size [b]; });
+
+    std::vector <bool> keep (com_size.size (), false);
+    for (size_t i = 0; i < order.size (); i ++)
+        if ((int) i < n_components ||
+                (min_size > 0 && com_size [order [i]] >= min_size))
+            keep [order [i]] = true;
+    return keep;
+}
+
+void remove_small_graph_components (vertex_vector &v, edge_vector &e,
+        std::vector <int> &components, const std::vector <bool> &keep)
+{
+    for (vertex_id_t i = 0; i < v.size (); i ++)
+        if (!keep [components [i]])
+            v [i].in_graph = false;
+    e.erase (std::remove_if (e.begin (), e.end (),
+                [&v] (osm_edge_t &edge) {
+                    return !v [edge.get_from_vertex ()].in_graph; }),
+            e.end ());
 }
 
-void remove_intermediate_vertices (vertex_map &v, edge_vector &e, replacement_map &reps)
+// Contracts all vertices with exactly two neighbours, one vertex at a time in
+// order of ID. The edges touching each vertex are found through per-vertex
+// incidence lists holding their positions in e in ascending order, so each
+// contraction only visits the edges of its own vertex rather than all of e.
+void remove_intermediate_vertices (vertex_vector &v, edge_vector &e,
+        replacement_map &reps)
 {
-    auto vert = v.begin ();
-    while (vert != v.end ())
+    std::vector <std::vector <size_t>> incident (v.size ());
+    auto add_incidence = [&incident, &e] (size_t k) {
+        incident [e [k].get_from_vertex ()].push_back (k);
+        if (e [k].getToVertex () != e [k].get_from_vertex ())
+            incident [e [k].getToVertex ()].push_back (k);
+    };
+    for (size_t k = 0; k < e.size (); k ++)
+        add_incidence (k);
+
+    for (vertex_id_t id = 0; id < v.size (); id ++)
     {
-        osm_id_t id = vert -> first;
-        osm_vertex_t vt = vert -> second;
+        if (!v [id].in_graph)
+            continue;
+        osm_vertex_t vt = v [id];
 
-        std::set <osm_id_t> n_all = vt.get_all_neighbours ();
+        std::set <vertex_id_t> n_all = vt.get_all_neighbours ();
         bool is_intermediate_single = vt.is_intermediate_single ();
         bool is_intermediate_double = vt.is_intermediate_double ();
 
         if (is_intermediate_single || is_intermediate_double)
         {
-            osm_id_t id_from_new, id_to_new;
+            vertex_id_t id_from_new = no_vertex, id_to_new = no_vertex;
 
             for (auto n_id:n_all)
             {
-                osm_id_t replacement_id;
+                vertex_id_t replacement_id = 0;
                 for (auto repl:n_all)
                     if (repl != n_id)
                         replacement_id = repl;
-                osm_vertex_t nVtx = v.at (n_id);
-                nVtx.replace_neighbour (id, replacement_id);
+                v [n_id].replace_neighbour (id, replacement_id);
                 if (is_intermediate_double)
                 {
                     id_from_new = n_id;
                     id_to_new = replacement_id;
                 }
-                v.at (n_id) = nVtx;
             }
 
             float dist_new = 0;
@@ -250,68 +336,57 @@ void remove_intermediate_vertices (vertex_map &v, edge_vector &e, replacement_ma
             int edges_to_delete = 1;
             if (is_intermediate_double)
                 edges_to_delete = 3;
-            auto edge = e.begin ();
-            while (edge != e.end ())
+            for (size_t j = 0; j < incident [id].size (); j ++)
             {
+                // edge is invalidated by the push_back calls below, after
+                // which the loop always ends
+                auto edge = e.begin () + incident [id] [j];
                 if (!edge -> replaced_by_compact)
                 {
-                    osm_id_t e_from = edge -> get_from_vertex ();
-                    osm_id_t e_to = edge -> getToVertex ();
-                    if (e_from == id || e_to == id)
-                    {
-                        std::set <int> comp_replacements =
-                            reps [edge -> getID ()];
-                        comp_replacements.insert (edge_ids);
-                        reps [edge -> getID ()] = comp_replacements;
-
-                        for (int k:comp_replacements)
-                        {
-                            std::set <int> cascade_repl = reps [k];
-                            cascade_repl.insert (edge -> getID ());
-                            cascade_repl.insert (comp_replacements.begin (),
-                                    comp_replacements.end ());
-                            reps [k] = cascade_repl;
-                        }
+                    vertex_id_t e_from = edge -> get_from_vertex ();
+                    vertex_id_t e_to = edge -> getToVertex ();
+                    reps.set (edge -> getID (), edge_ids);
 
-                        edge -> replaced_by_compact = true;
-                        if (is_intermediate_single)
-                        {
-                            if (e_from == id)
-                                id_to_new = e_to;
-                            if (e_to == id)
-                                id_from_new = e_from;
-                        }
-                        hw_new = edge -> highway;
-                        dist_new += edge -> dist;
-                        weight_new += edge -> weight;
-                        std::set <int> replacing_edges =
-                            edge -> is_replacement_for ();
-                        if (num_found >= edges_to_delete)
+                    edge -> replaced_by_compact = true;
+                    if (is_intermediate_single)
+                    {
+                        if (e_from == id)
+                            id_to_new = e_to;
+                        if (e_to == id)
+                            id_from_new = e_from;
+                    }
+                    hw_new = edge -> highway;
+                    dist_new += edge -> dist;
+                    weight_new += edge -> weight;
+                    if (num_found >= edges_to_delete)
+                    {
+                        if (id_from_new == no_vertex ||
+                                id_to_new == no_vertex)
+                            throw std::runtime_error (
+                                    "compact edge has no end vertex");
+                        if (is_intermediate_double)
                         {
-                            replacing_edges.insert (edge -> getID ());
-                            if (is_intermediate_double)
-                            {
-                                dist_new = dist_new / 2;
-                                weight_new = weight_new / 2;
-                                osm_edge_t edge_new = osm_edge_t (id_to_new,
-                                        id_from_new, dist_new, weight_new,
-                                        hw_new, edge_ids ++, replacing_edges,
-                                        false);
-                                e.push_back (edge_new);
-                            }
-                            osm_edge_t edge_new = osm_edge_t (id_from_new,
-                                    id_to_new, dist_new, weight_new, hw_new,
-                                    edge_ids ++, replacing_edges, false);
+                            dist_new = dist_new / 2;
+                            weight_new = weight_new / 2;
+                            osm_edge_t edge_new = osm_edge_t (id_to_new,
+                                    id_from_new, dist_new, weight_new,
+                                    hw_new, edge_ids ++, false);
                             e.push_back (edge_new);
-                            break;
+                            add_incidence (e.size () - 1);
                         }
-                        num_found ++;
+                        osm_edge_t edge_new = osm_edge_t (id_from_new,
+                                id_to_new, dist_new, weight_new, hw_new,
+                                edge_ids ++, false);
+                        e.push_back (edge_new);
+                        add_incidence (e.size () - 1);
+                        break;
                     }
+                    num_found ++;
                 }
-                edge ++;
             }
+            // id is never visited again
+            std::vector <size_t> ().swap (incident [id]);
         }
-        vert ++;
     }
 }
 
@@ -320,6 +395,9 @@ void remove_intermediate_vertices (vertex_map &v, edge_vector &e, replacement_ma
 //' Removes nodes and edges from a graph that are not needed for routing
 //'
 //' @param graph graph to be processed
+//' @param n_components Number of largest connected components to retain
+//' @param min_component_size Also retain all components with at least this
+//' many vertices (ignored if 0)
 //' @return \code{Rcpp::List} containing one \code{data.frame} with the compact
 //' graph, one \code{data.frame} with the original graph and one
 //' \code{data.frame} containing information about the relating edge ids of the
@@ -327,18 +405,20 @@ void remove_intermediate_vertices (vertex_map &v, edge_vector &e, replacement_ma
 //'
 //' @noRd
 // [[Rcpp::export]]
-Rcpp::List rcpp_make_compact_graph (Rcpp::DataFrame graph)
+Rcpp::List rcpp_make_compact_graph (Rcpp::DataFrame graph,
+        int n_components = 1, int min_component_size = 0)
 {
-    vertex_map vertices;
+    vertex_vector vertices;
     edge_vector edges;
     replacement_map rep_map;
-    std::map <osm_id_t, int> components;
-    int largest_component;
+    std::vector <osm_id_t> ids;
+    std::vector <int> components, component_size;
 
-    graph_from_df (graph, vertices, edges);
-    get_largest_graph_component (vertices, components, largest_component);
+    graph_from_df (graph, vertices, edges, ids);
+    get_graph_components (vertices, components, component_size);
     remove_small_graph_components (vertices, edges, components,
-            largest_component);
+            select_graph_components (component_size, n_components,
+                min_component_size));
     remove_intermediate_vertices (vertices, edges, rep_map);
 
     Rcpp::StringVector from_compact, to_compact, highway_compact, from_og,
@@ -347,15 +427,13 @@ Rcpp::List rcpp_make_compact_graph (Rcpp::DataFrame graph)
     to_lon_compact, dist_compact, weight_compact, edgeid_compact, from_lat_og,
     from_lon_og, to_lat_og, to_lon_og, dist_og, weight_og, edgeid_og;
 
-    std::vector <std::pair <osm_id_t, osm_id_t>> e_pairs;
-
     Rcpp::NumericVector rp_orig, rp_comp;
     for (auto e:edges)
     {
-        osm_id_t from = e.get_from_vertex ();
-        osm_id_t to = e.getToVertex ();
-        osm_vertex_t from_vtx = vertices.at (from);
-        osm_vertex_t to_vtx = vertices.at (to);
+        const osm_vertex_t &from_vtx = vertices [e.get_from_vertex ()];
+        const osm_vertex_t &to_vtx = vertices [e.getToVertex ()];
+        const osm_id_t &from = ids [e.get_from_vertex ()];
+        const osm_id_t &to = ids [e.getToVertex ()];
 
         if (!e.replaced_by_compact)
         {
@@ -384,13 +462,7 @@ Rcpp::List rcpp_make_compact_graph (Rcpp::DataFrame graph)
             to_lon_og.push_back (to_vtx.getLon ());
             edgeid_og.push_back (edge_id);
             rp_orig.push_back (edge_id);
-            if (rep_map.find (edge_id) == rep_map.end ())
-                rp_comp.push_back (edge_id);
-            else
-            {
-                std::set <int> replacements = rep_map [edge_id];
-                rp_comp.push_back (*replacements.rbegin ());
-            }
+            rp_comp.push_back (rep_map.get_compact_edge (edge_id));
         }
     }
 
@@ -0,0 +1,105 @@
+/***************************************************************************
+ *  Project:    osmprob
+ *  File:       haversine.h
+ *  Language:   C++
+ *
+ *  Description:    Great circle distances, shared by network construction,
+ *                  the routing heuristics and nearest vertex searches. Points
+ *                  which recur in many distances are converted once into
+ *                  radians together with the cosine of their latitude, so
+ *                  that each distance needs only two sines, a square root
+ *                  and an arc sine. Batches run over contiguous arrays in
+ *                  loops which the compiler may vectorise.
+ *
+ *  Compiler Options:   -std=c++11
+ ***************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+
+const double deg_to_rad = M_PI / 180.0;
+
+// Radius (in km) by which the distances of network edges (d) are scaled.
+// This is 3671 rather than the mean radius of the earth of 6371 km, as in
+// the original network code, and is kept so that d remains consistent with
+// road_data_sample and with graphs built before. It must not be used for
+// distances which are reported to users as great circle distances.
+const double network_radius = 3671.0;
+
+// Mean radius of the earth (in km), for great circle distances as such
+const double earth_radius = 6371.0;
+
+// Central angle (in radians) between two points given in radians, along
+// with the cosines of their latitudes, by the haversine formula
+inline double haversine_angle (double x1, double y1, double cos_y1,
+        double x2, double y2, double cos_y2)
+{
+    const double sx = std::sin (0.5 * (x2 - x1));
+    const double sy = std::sin (0.5 * (y2 - y1));
+    const double d = sy * sy + cos_y1 * cos_y2 * sx * sx;
+    return 2.0 * std::asin (std::sqrt (d));
+}
+
+// Haversine great circle distance, scaled by network_radius, between two
+// points given in radians, along with the cosines of their latitudes
+inline double haversine_rad (double x1, double y1, double cos_y1,
+        double x2, double y2, double cos_y2)
+{
+    return network_radius * haversine_angle (x1, y1, cos_y1, x2, y2, cos_y2);
+}
+
+// Haversine great circle distance, scaled by network_radius, between two
+// points given in degrees
+inline double haversine (double x1, double y1, double x2, double y2)
+{
+    return haversine_rad (x1 * deg_to_rad, y1 * deg_to_rad,
+            std::cos (y1 * deg_to_rad), x2 * deg_to_rad, y2 * deg_to_rad,
+            std::cos (y2 * deg_to_rad));
+}
+
+// d [i] = distance between points i of (x1, y1) and of (x2, y2), all in
+// radians with cached cosines of latitude
+inline void haversine_batch (size_t n, const double *x1, const double *y1,
+        const double *cos_y1, const double *x2, const double *y2,
+        const double *cos_y2, double *d)
+{
+    #pragma omp simd
+    for (size_t i = 0; i < n; i++)
+        d [i] = haversine_rad (x1 [i], y1 [i], cos_y1 [i], x2 [i], y2 [i],
+                cos_y2 [i]);
+}
+
+// Points in radians with the cosines of their latitudes
+struct haversine_points_t
+{
+    std::vector <double> x, y, cos_y;
+
+    size_t size () const { return x.size (); }
+
+    void assign (const double *lon, const double *lat, size_t n)
+    {
+        x.resize (n);
+        y.resize (n);
+        cos_y.resize (n);
+        #pragma omp simd
+        for (size_t i = 0; i < n; i++)
+        {
+            x [i] = lon [i] * deg_to_rad;
+            y [i] = lat [i] * deg_to_rad;
+            cos_y [i] = std::cos (y [i]);
+        }
+    }
+
+    // d [i] = distance between consecutive points i and i + 1, for all
+    // n - 1 segments of the polyline held by these points
+    void segment_lengths (std::vector <double> &d) const
+    {
+        const size_t n = size () > 0 ? size () - 1 : 0;
+        d.resize (n);
+        haversine_batch (n, x.data (), y.data (), cos_y.data (),
+                x.data () + 1, y.data () + 1, cos_y.data () + 1, d.data ());
+    }
+};
@@ -0,0 +1,198 @@
+/***************************************************************************
+ *  Project:    osmprob
+ *  File:       kdtree.h
+ *  Language:   C++
+ *
+ *  Description:    Static k-d tree over points given in longitude and
+ *                  latitude, for nearest and k-nearest neighbour queries by
+ *                  great circle distance. Points are mapped on to the unit
+ *                  sphere, where straight line (chord) distances order
+ *                  points exactly as great circle distances do.
+ *                  nearest_points runs batches of queries against a tree.
+ *
+ *  Compiler Options:   -std=c++11
+ ***************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <queue>
+#include <utility>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <exception>
+
+#include "haversine.h"
+
+class kdtree_t
+{
+    private:
+        static const size_t leaf_size = 8;
+        std::vector <double> xyz; // 3 coordinates per point on the sphere
+        std::vector <size_t> perm; // tree order of point indices
+        std::vector <unsigned char> axis; // split axis of each subtree mid
+
+        static void to_sphere (double lon, double lat, double *p)
+        {
+            const double x = lon * M_PI / 180.0, y = lat * M_PI / 180.0;
+            p [0] = std::cos (y) * std::cos (x);
+            p [1] = std::cos (y) * std::sin (x);
+            p [2] = std::sin (y);
+        }
+
+        double dist2 (const double *q, size_t i) const
+        {
+            const double *p = &xyz [3 * i];
+            return (q [0] - p [0]) * (q [0] - p [0]) +
+                (q [1] - p [1]) * (q [1] - p [1]) +
+                (q [2] - p [2]) * (q [2] - p [2]);
+        }
+
+        // Split [lo, hi) of perm at its median along the axis of widest
+        // spread, and recurse on both halves
+        void build_range (size_t lo, size_t hi)
+        {
+            if (hi - lo <= leaf_size)
+                return;
+            double pmin [3], pmax [3];
+            for (int a = 0; a < 3; a++)
+            {
+                pmin [a] = pmax [a] = xyz [3 * perm [lo] + a];
+                for (size_t i = lo + 1; i < hi; i++)
+                {
+                    pmin [a] = std::min (pmin [a], xyz [3 * perm [i] + a]);
+                    pmax [a] = std::max (pmax [a], xyz [3 * perm [i] + a]);
+                }
+            }
+            unsigned char ax = 0;
+            for (unsigned char a = 1; a < 3; a++)
+                if (pmax [a] - pmin [a] > pmax [ax] - pmin [ax])
+                    ax = a;
+
+            const size_t mid = lo + (hi - lo) / 2;
+            std::nth_element (perm.begin () + lo, perm.begin () + mid,
+                    perm.begin () + hi, [this, ax] (size_t a, size_t b) {
+                        return xyz [3 * a + ax] < xyz [3 * b + ax]; });
+            axis [mid] = ax;
+            build_range (lo, mid);
+            build_range (mid + 1, hi);
+        }
+
+        typedef std::priority_queue <std::pair <double, size_t> > best_t;
+
+        void search (const double *q, size_t k, size_t lo, size_t hi,
+                best_t &best) const
+        {
+            if (hi - lo <= leaf_size)
+            {
+                for (size_t i = lo; i < hi; i++)
+                    offer (dist2 (q, perm [i]), perm [i], k, best);
+                return;
+            }
+            const size_t mid = lo + (hi - lo) / 2;
+            const double diff = q [axis [mid]] - xyz [3 * perm [mid] +
+                axis [mid]];
+            offer (dist2 (q, perm [mid]), perm [mid], k, best);
+            // Descend first into the side containing q
+            if (diff < 0.0)
+                search (q, k, lo, mid, best);
+            else
+                search (q, k, mid + 1, hi, best);
+            if (best.size () < k || diff * diff < best.top ().first)
+            {
+                if (diff < 0.0)
+                    search (q, k, mid + 1, hi, best);
+                else
+                    search (q, k, lo, mid, best);
+            }
+        }
+
+        static void offer (double d2, size_t i, size_t k, best_t &best)
+        {
+            if (best.size () < k)
+                best.push (std::make_pair (d2, i));
+            else if (d2 < best.top ().first)
+            {
+                best.pop ();
+                best.push (std::make_pair (d2, i));
+            }
+        }
+
+    public:
+        size_t size () const { return perm.size (); }
+
+        // Points with non-finite coordinates are left out of the tree
+        void build (const std::vector <double> &lon,
+                const std::vector <double> &lat)
+        {
+            xyz.resize (3 * lon.size ());
+            perm.clear ();
+            for (size_t i = 0; i < lon.size (); i++)
+            {
+                to_sphere (lon [i], lat [i], &xyz [3 * i]);
+                if (std::isfinite (lon [i]) && std::isfinite (lat [i]))
+                    perm.push_back (i);
+            }
+            axis.assign (perm.size (), 0);
+            build_range (0, perm.size ());
+        }
+
+        // Indices of the (up to) k points nearest to (lon, lat), in order of
+        // increasing distance. Ties are resolved arbitrarily, and a query
+        // with non-finite coordinates has no neighbours.
+        std::vector <size_t> nearest (double lon, double lat, size_t k) const
+        {
+            if (!std::isfinite (lon) || !std::isfinite (lat))
+                return std::vector <size_t> ();
+            double q [3];
+            to_sphere (lon, lat, q);
+            best_t best;
+            if (k > 0)
+                search (q, k, 0, perm.size (), best);
+            std::vector <size_t> res (best.size ());
+            for (size_t i = res.size (); i-- > 0; best.pop ())
+                res [i] = best.top ().second;
+            return res;
+        }
+};
+
+// The k points of tree nearest to each of n query points, in order of
+// increasing distance, where vp holds the points of the tree. Neighbour j of
+// query i is nearest [i + j * n] at great circle distance d [i + j * n] (in
+// km, on a sphere of earth_radius), or -1 if the tree has fewer than k
+// points or the query is not finite. Exceptions may not leave a parallel
+// region, so the first one is rethrown after it.
+inline void nearest_points (const kdtree_t &tree,
+        const haversine_points_t &vp, const std::vector <double> &lon,
+        const std::vector <double> &lat, size_t k,
+        std::vector <long long> &nearest, std::vector <double> &d)
+{
+    const size_t n = lon.size ();
+    nearest.assign (n * k, -1);
+    d.assign (n * k, std::numeric_limits <double>::infinity ());
+    std::exception_ptr error;
+    #pragma omp parallel for schedule (static)
+    for (long i = 0; i < (long) n; i++)
+    {
+        try
+        {
+            std::vector <size_t> nn = tree.nearest (lon [i], lat [i], k);
+            const double qx = lon [i] * deg_to_rad,
+                  qy = lat [i] * deg_to_rad, qcos = std::cos (qy);
+            for (size_t j = 0; j < nn.size (); j++)
+            {
+                nearest [i + j * n] = (long long) nn [j];
+                d [i + j * n] = earth_radius * haversine_angle (vp.x [nn [j]],
+                        vp.y [nn [j]], vp.cos_y [nn [j]], qx, qy, qcos);
+            }
+        } catch (...)
+        {
+            #pragma omp critical
+            if (!error)
+                error = std::current_exception ();
+        }
+    }
+    if (error)
+        std::rethrow_exception (error);
+}
@@ -30,20 +30,12 @@
  ***************************************************************************/
 
 #include <string>
+#include <vector>
 #include <cmath>
 
 #include <Rcpp.h>
 
-// Haversine great circle distance between two points
-float haversine (float x1, float y1, float x2, float y2)
-{
-    float xd = (x2 - x1) * M_PI / 180.0;
-    float yd = (y2 - y1) * M_PI / 180.0;
-    float d = sin (yd / 2.0) * sin (yd / 2.0) + cos (y2 * M_PI / 180.0) *
-        cos (y1 * M_PI / 180.0) * sin (xd / 2.0) * sin (xd / 2.0);
-    d = 2.0 * 3671.0 * asin (sqrt (d));
-    return (d);
-}
+#include "network.h"
 
 //' rcpp_lines_as_network
 //'
@@ -59,11 +51,9 @@ float haversine (float x1, float y1, float x2, float y2)
 Rcpp::List rcpp_lines_as_network (const Rcpp::List &sf_lines,
         Rcpp::DataFrame pr)
 {
-    std::map <std::string, float> profile;
-    Rcpp::StringVector hw = pr [1];
-    Rcpp::NumericVector val = pr [2];
-    for (int i = 0; i != hw.size (); i ++)
-        profile.insert (std::make_pair (std::string (hw [i]), val [i]));
+    highway_table_t hw_table (
+            Rcpp::as <std::vector <std::string> > (pr [1]),
+            Rcpp::as <std::vector <double> > (pr [2]));
 
     Rcpp::CharacterVector nms = sf_lines.attr ("names");
     if (nms [nms.size () - 1] != "geometry")
@@ -102,44 +92,41 @@ Rcpp::List rcpp_lines_as_network (const Rcpp::List &sf_lines,
             ow = owb;
     }
 
+    // First pass: the output rows of each geometry start at
+    // lines.offsets [g], and each geometry's highway type is resolved to a
+    // class indexing a dense table of profile weights, so the fill below
+    // does no string lookups. lines keeps raw pointers into the
+    // geometries, so those which Rcpp has to coerce to numeric are held
+    // (and so protected) in gmats until the matrix is filled.
     Rcpp::List geoms = sf_lines [nms.size () - 1];
-    std::vector<bool> isOneWay (geoms.length ());
-    std::fill (isOneWay.begin (), isOneWay.end (), false);
-    // Get dimension of matrix
-    size_t nrows = 0;
-    int ngeoms = 0;
-    for (auto g = geoms.begin (); g != geoms.end (); ++g)
+    const size_t ngeoms = geoms.length ();
+    std::vector <Rcpp::NumericMatrix> gmats;
+    gmats.reserve (ngeoms);
+    network_lines_t lines;
+    for (size_t g = 0; g < ngeoms; g++)
     {
-        // Rcpp uses an internal proxy iterator here, NOT a direct copy
-        Rcpp::NumericMatrix gi = (*g);
-        int rows = gi.nrow () - 1;
-        nrows += rows;
-        if (ngeoms < ow.size ())
-        {
-            if (!(ow [ngeoms] == "yes" || ow [ngeoms] == "-1"))
-            {
-                nrows += rows;
-                isOneWay [ngeoms] = true;
-            }
-        }
-        ngeoms ++;
+        gmats.push_back (Rcpp::as <Rcpp::NumericMatrix> (geoms [g]));
+        Rcpp::NumericMatrix &gi = gmats.back ();
+        const bool both_ways = g < (size_t) ow.size () &&
+            !(ow [g] == "yes" || ow [g] == "-1");
+        lines.add (gi.begin (), gi.begin () + gi.nrow (), gi.nrow (),
+                both_ways, hw_table.class_of (std::string (highway [g])));
     }
+    const size_t nrows = lines.nrows ();
 
     Rcpp::NumericMatrix nmat = Rcpp::NumericMatrix (Rcpp::Dimension (nrows, 6));
     Rcpp::CharacterMatrix idmat = Rcpp::CharacterMatrix (Rcpp::Dimension (nrows,
                 3));
 
-    nrows = 0;
-    ngeoms = 0;
+    // Second pass fills the numeric matrix in parallel, through raw pointers,
+    // because no R API may be called off the main thread
+    fill_network_matrix (lines, hw_table.factors, nmat.begin ());
+
+    // Vertex IDs are R strings, so idmat is filled serially
     int fake_id = 0;
-    for (auto g = geoms.begin (); g != geoms.end (); ++ g)
+    for (size_t g = 0; g < ngeoms; g++)
     {
-        Rcpp::NumericMatrix gi = (*g);
-        std::string hway = std::string (highway [ngeoms]);
-        float hw_factor = profile [hway];
-        if (hw_factor == 0) hw_factor = 1e-5;
-        hw_factor /= 1;
-
+        Rcpp::NumericMatrix &gi = gmats [g];
         Rcpp::List ginames = gi.attr ("dimnames");
         Rcpp::CharacterVector rnms;
         if (ginames.length () > 0)
@@ -153,35 +140,22 @@ Rcpp::List rcpp_lines_as_network (const Rcpp::List &sf_lines,
         if (rnms.size () != gi.nrow ())
             throw std::runtime_error ("geom size differs from rownames");
 
+        const std::string &hway = hw_table.names [lines.hw_class [g]];
+        size_t row = lines.offsets [g];
         for (int i = 1; i < gi.nrow (); i ++)
         {
-            float d = haversine (gi (i-1, 0), gi (i-1, 1), gi (i, 0),
-                    gi (i, 1));
-            nmat (nrows, 0) = gi (i-1, 0);
-            nmat (nrows, 1) = gi (i-1, 1);
-            nmat (nrows, 2) = gi (i, 0);
-            nmat (nrows, 3) = gi (i, 1);
-            nmat (nrows, 4) = d;
-            nmat (nrows, 5) = d * hw_factor;
-            idmat (nrows, 0) = rnms (i-1);
-            idmat (nrows, 1) = rnms (i);
-            idmat (nrows, 2) = hway;
-            nrows ++;
-            if (isOneWay [ngeoms])
+            idmat (row, 0) = rnms (i-1);
+            idmat (row, 1) = rnms (i);
+            idmat (row, 2) = hway;
+            row ++;
+            if (lines.both_ways [g])
             {
-                nmat (nrows, 0) = gi (i, 0);
-                nmat (nrows, 1) = gi (i, 1);
-                nmat (nrows, 2) = gi (i-1, 0);
-                nmat (nrows, 3) = gi (i-1, 1);
-                nmat (nrows, 4) = d;
-                nmat (nrows, 5) = d * hw_factor;
-                idmat (nrows, 0) = rnms (i);
-                idmat (nrows, 1) = rnms (i-1);
-                idmat (nrows, 2) = hway;
-                nrows ++;
+                idmat (row, 0) = rnms (i);
+                idmat (row, 1) = rnms (i-1);
+                idmat (row, 2) = hway;
+                row ++;
             }
         }
-        ngeoms ++;
     }
 
     Rcpp::List res (2);
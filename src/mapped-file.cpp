@@ -0,0 +1,106 @@
+/***************************************************************************
+ *  Project:    osmprob
+ *  File:       mapped-file.cpp
+ *  Language:   C++
+ *
+ *  Description:    Read-only memory mapping of a whole file, through mmap
+ *                  on POSIX systems and file mapping objects on Windows.
+ *                  Empty files are not mapped, and have null data.
+ *
+ *  Compiler Options:   -std=c++11
+ ***************************************************************************/
+
+#include "mapped-file.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+
+struct mapping_handle_t
+{
+    HANDLE file, mapping;
+};
+
+mapped_file_t::mapped_file_t (const std::string &path)
+{
+    HANDLE file = CreateFileA (path.c_str (), GENERIC_READ, FILE_SHARE_READ,
+            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error ("unable to open file " + path);
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx (file, &size))
+    {
+        CloseHandle (file);
+        throw std::runtime_error ("unable to read size of file " + path);
+    }
+    _size = static_cast <size_t> (size.QuadPart);
+    HANDLE mapping = NULL;
+    if (_size > 0)
+    {
+        mapping = CreateFileMappingA (file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping != NULL)
+            _data = static_cast <const char *> (MapViewOfFile (mapping,
+                        FILE_MAP_READ, 0, 0, 0));
+        if (_data == nullptr)
+        {
+            if (mapping != NULL)
+                CloseHandle (mapping);
+            CloseHandle (file);
+            throw std::runtime_error ("unable to map file " + path);
+        }
+    }
+    _handle = new mapping_handle_t {file, mapping};
+}
+
+mapped_file_t::~mapped_file_t ()
+{
+    mapping_handle_t *h = static_cast <mapping_handle_t *> (_handle);
+    if (_data != nullptr)
+        UnmapViewOfFile (_data);
+    if (h->mapping != NULL)
+        CloseHandle (h->mapping);
+    CloseHandle (h->file);
+    delete h;
+}
+
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+mapped_file_t::mapped_file_t (const std::string &path)
+{
+    const int fd = open (path.c_str (), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error ("unable to open file " + path);
+    struct stat st;
+    if (fstat (fd, &st) != 0)
+    {
+        close (fd);
+        throw std::runtime_error ("unable to read size of file " + path);
+    }
+    _size = static_cast <size_t> (st.st_size);
+    if (_size > 0)
+    {
+        void *p = mmap (nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            close (fd);
+            throw std::runtime_error ("unable to map file " + path);
+        }
+        _data = static_cast <const char *> (p);
+    }
+    // The mapping remains valid once the descriptor is closed
+    close (fd);
+}
+
+mapped_file_t::~mapped_file_t ()
+{
+    if (_data != nullptr)
+        munmap (const_cast <char *> (_data), _size);
+}
+#endif
@@ -0,0 +1,37 @@
+/***************************************************************************
+ *  Project:    osmprob
+ *  File:       mapped-file.h
+ *  Language:   C++
+ *
+ *  Description:    Read-only memory mapping of a whole file. The mapping
+ *                  lives in its own translation unit (mapped-file.cpp), which
+ *                  keeps the system headers it needs apart from R's.
+ *
+ *  Compiler Options:   -std=c++11
+ ***************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+class mapped_file_t
+{
+    private:
+        const char *_data = nullptr;
+        size_t _size = 0;
+        void *_handle = nullptr; // platform-specific mapping state
+
+    public:
+        // Throws std::runtime_error if the file can not be opened or mapped
+        explicit mapped_file_t (const std::string &path);
+        ~mapped_file_t ();
+
+        mapped_file_t (const mapped_file_t &) = delete;
+        mapped_file_t &operator= (const mapped_file_t &) = delete;
+
+        const char *data () const { return _data; }
+        size_t size () const { return _size; }
+        const char *begin () const { return _data; }
+        const char *end () const { return _data + _size; }
+};
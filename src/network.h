@@ -0,0 +1,147 @@
+/***************************************************************************
+ *  Project:    osmprob
+ *  File:       network.h
+ *  Language:   C++
+ *
+ *  Description:    Conversion of weighted polylines into the rows of the
+ *                  network matrix, shared by the readers of sf LINESTRING
+ *                  collections (lines-as-network.cpp) and of OSM XML files
+ *                  (osm-xml.cpp). Nothing here touches the R API, so the
+ *                  matrix can be filled in parallel.
+ *
+ *  Compiler Options:   -std=c++11
+ ***************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <exception>
+
+#include "haversine.h"
+
+// Highway types in order of first appearance, with their profile weights.
+// Types absent from the profile, or weighted zero, get a weight of 1e-5.
+class highway_table_t
+{
+    private:
+        std::unordered_map <std::string, float> profile;
+        std::unordered_map <std::string, size_t> index;
+
+    public:
+        std::vector <std::string> names;
+        std::vector <float> factors;
+
+        // The first weight given for a type is used
+        highway_table_t (const std::vector <std::string> &hw,
+                const std::vector <double> &val)
+        {
+            for (size_t i = 0; i < hw.size (); i++)
+                profile.insert (std::make_pair (hw [i], (float) val [i]));
+        }
+
+        size_t class_of (const std::string &hway)
+        {
+            auto h = index.find (hway);
+            if (h != index.end ())
+                return h->second;
+
+            float hw_factor = 0.0;
+            auto p = profile.find (hway);
+            if (p != profile.end ())
+                hw_factor = p->second;
+            if (hw_factor == 0) hw_factor = 1e-5;
+            index.insert (std::make_pair (hway, names.size ()));
+            names.push_back (hway);
+            factors.push_back (hw_factor);
+            return names.size () - 1;
+        }
+};
+
+// Polylines to be converted into network rows. Line g has npoints [g]
+// points at (x [g] [i], y [g] [i]), and gives rows [offsets [g], offsets [g +
+// 1]): one per segment, or two (forward and reverse) when both_ways [g].
+struct network_lines_t
+{
+    std::vector <const double *> x, y;
+    std::vector <int> npoints;
+    std::vector <char> both_ways;
+    std::vector <size_t> hw_class;
+    std::vector <size_t> offsets = std::vector <size_t> (1, 0);
+
+    size_t size () const { return npoints.size (); }
+    size_t nrows () const { return offsets.back (); }
+
+    void add (const double *xg, const double *yg, int n, bool both,
+            size_t hw)
+    {
+        x.push_back (xg);
+        y.push_back (yg);
+        npoints.push_back (n);
+        both_ways.push_back (both);
+        hw_class.push_back (hw);
+        size_t rows = n > 1 ? n - 1 : 0;
+        if (both)
+            rows *= 2;
+        offsets.push_back (offsets.back () + rows);
+    }
+};
+
+// Write one row of the column-major network matrix with nrows rows
+inline void fill_network_row (double *nmat, size_t nrows, size_t row,
+        double x1, double y1, double x2, double y2, double d, double d_weighted)
+{
+    nmat [row] = x1;
+    nmat [row + nrows] = y1;
+    nmat [row + 2 * nrows] = x2;
+    nmat [row + 3 * nrows] = y2;
+    nmat [row + 4 * nrows] = d;
+    nmat [row + 5 * nrows] = d_weighted;
+}
+
+// Fill the (lines.nrows () x 6) network matrix of (x1, y1, x2, y2, d,
+// d_weighted), in parallel over lines. Each line writes only its own rows.
+// Segment lengths of each line come from one batch over its points, which
+// are converted to radians only once. Exceptions may not leave a parallel
+// region, so the first one is rethrown after it.
+inline void fill_network_matrix (const network_lines_t &lines,
+        const std::vector <float> &hw_factors, double *nmat)
+{
+    const size_t nrows = lines.nrows ();
+    std::exception_ptr error;
+    #pragma omp parallel
+    {
+        haversine_points_t pts;
+        std::vector <double> dist;
+        #pragma omp for schedule (dynamic, 64)
+        for (long g = 0; g < (long) lines.size (); g++)
+        {
+            try
+            {
+                const double *x = lines.x [g];
+                const double *y = lines.y [g];
+                const double hw_factor = hw_factors [lines.hw_class [g]];
+                pts.assign (x, y, lines.npoints [g]);
+                pts.segment_lengths (dist);
+                size_t row = lines.offsets [g];
+                for (int i = 1; i < lines.npoints [g]; i ++)
+                {
+                    const double d = dist [i - 1];
+                    fill_network_row (nmat, nrows, row++, x [i-1], y [i-1],
+                            x [i], y [i], d, d * hw_factor);
+                    if (lines.both_ways [g])
+                        fill_network_row (nmat, nrows, row++, x [i], y [i],
+                                x [i-1], y [i-1], d, d * hw_factor);
+                }
+            } catch (...)
+            {
+                #pragma omp critical
+                if (!error)
+                    error = std::current_exception ();
+            }
+        }
+    }
+    if (error)
+        std::rethrow_exception (error);
+}
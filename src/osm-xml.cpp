@@ -0,0 +1,343 @@
+/***************************************************************************
+ *  Project:    osmprob
+ *  File:       osm-xml.cpp
+ *  Language:   C++
+ *
+ *  Description:    Read the highways of an OSM XML file directly into the
+ *                  network matrices returned by rcpp_lines_as_network,
+ *                  without first building an sf collection in R. The file
+ *                  is memory-mapped and scanned in place: attribute values
+ *                  are held as spans of the mapped text, and only node
+ *                  coordinates and the tags needed for routing are decoded.
+ *
+ *  Compiler Options:   -std=c++11
+ ***************************************************************************/
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+#include <cstdlib>
+
+#include <Rcpp.h>
+
+#include "mapped-file.h"
+#include "network.h"
+
+// A span of the mapped file, neither copied nor null-terminated
+struct xml_span_t
+{
+    const char *p = nullptr;
+    size_t n = 0;
+
+    bool empty () const { return p == nullptr; }
+    bool operator== (const char *s) const
+    {
+        return p != nullptr && strlen (s) == n && strncmp (p, s, n) == 0;
+    }
+    std::string str () const { return std::string (p, n); }
+};
+
+// One element tag, <name attr="value" ...> or </name>
+struct xml_element_t
+{
+    xml_span_t name;
+    std::vector <std::pair <xml_span_t, xml_span_t> > attrs;
+    bool closing = false, self_closing = false;
+
+    xml_span_t attr (const char *key) const
+    {
+        for (auto &a : attrs)
+            if (a.first == key)
+                return a.second;
+        return xml_span_t ();
+    }
+};
+
+inline bool is_xml_space (char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+inline bool starts_with (const char *p, const char *end, const char *s)
+{
+    const size_t n = strlen (s);
+    return (size_t) (end - p) >= n && strncmp (p, s, n) == 0;
+}
+
+// Position just past the first occurrence of s in [p, end), or end
+inline const char *skip_past (const char *p, const char *end, const char *s)
+{
+    const size_t n = strlen (s);
+    for ( ; p + n <= end; p++)
+        if (strncmp (p, s, n) == 0)
+            return p + n;
+    return end;
+}
+
+// Parse the element tag starting at the '<' at p into e, and return the
+// position just past its closing '>'
+const char *parse_xml_element (const char *p, const char *end,
+        xml_element_t &e)
+{
+    e.attrs.clear ();
+    e.closing = e.self_closing = false;
+    p++;
+    if (p < end && *p == '/')
+    {
+        e.closing = true;
+        p++;
+    }
+    const char *q = p;
+    while (q < end && !is_xml_space (*q) && *q != '>' && *q != '/')
+        q++;
+    e.name.p = p;
+    e.name.n = q - p;
+    p = q;
+
+    while (p < end)
+    {
+        while (p < end && is_xml_space (*p))
+            p++;
+        if (p == end)
+            break;
+        if (*p == '>')
+            return p + 1;
+        if (*p == '/')
+        {
+            e.self_closing = true;
+            p++;
+            continue;
+        }
+        xml_span_t key;
+        key.p = p;
+        while (p < end && *p != '=' && *p != '>' && !is_xml_space (*p))
+            p++;
+        key.n = p - key.p;
+        while (p < end && *p != '"' && *p != '\'' && *p != '>')
+            p++;
+        if (p == end || *p == '>')
+            continue;
+        const char quote = *p++;
+        xml_span_t val;
+        val.p = p;
+        while (p < end && *p != quote)
+            p++;
+        if (p == end)
+            throw std::runtime_error ("unterminated XML attribute value");
+        val.n = p - val.p;
+        p++;
+        e.attrs.push_back (std::make_pair (key, val));
+    }
+    throw std::runtime_error ("unterminated XML element");
+}
+
+inline long long parse_osm_id (const xml_span_t &s)
+{
+    if (s.empty () || s.n == 0)
+        throw std::runtime_error ("OSM element has no id");
+    size_t i = 0;
+    const bool negative = s.p [0] == '-';
+    if (negative)
+        i++;
+    long long id = 0;
+    for ( ; i < s.n; i++)
+    {
+        if (s.p [i] < '0' || s.p [i] > '9')
+            throw std::runtime_error ("invalid OSM id " + s.str ());
+        id = 10 * id + (s.p [i] - '0');
+    }
+    return negative ? -id : id;
+}
+
+// Values are always followed by their closing quote, which ends strtod
+inline double parse_osm_coordinate (const xml_span_t &s)
+{
+    if (s.empty ())
+        throw std::runtime_error ("OSM node has no coordinates");
+    return std::strtod (s.p, nullptr);
+}
+
+// The nodes and highway ways of an OSM XML file. Way w refers to nodes
+// refs [ref_offsets [w]] ... refs [ref_offsets [w + 1] - 1].
+struct osm_highways_t
+{
+    std::vector <xml_span_t> node_id;
+    std::vector <double> node_lon, node_lat;
+    std::unordered_map <long long, size_t> node_index;
+
+    std::vector <long long> refs;
+    std::vector <size_t> ref_offsets = std::vector <size_t> (1, 0);
+    std::vector <xml_span_t> highway, oneway, oneway_bicycle;
+
+    size_t nways () const { return highway.size (); }
+};
+
+// Ways are kept when tagged as highways and not as areas, as in the osmdata
+// queries of download_graph ()
+void read_osm_highways (const char *p, const char *end, osm_highways_t &osm)
+{
+    xml_element_t e;
+    bool in_way = false, way_is_area = false;
+    xml_span_t way_highway, way_oneway, way_oneway_bicycle;
+    size_t way_ref_start = 0;
+
+    while ((p = static_cast <const char *> (
+                    memchr (p, '<', end - p))) != nullptr)
+    {
+        if (starts_with (p, end, "<!--"))
+        {
+            p = skip_past (p, end, "-->");
+            continue;
+        }
+        if (starts_with (p, end, "<?") || starts_with (p, end, "<!"))
+        {
+            p = skip_past (p, end, ">");
+            continue;
+        }
+        p = parse_xml_element (p, end, e);
+
+        if (e.name == "node" && !e.closing)
+        {
+            const long long id = parse_osm_id (e.attr ("id"));
+            osm.node_index.insert (std::make_pair (id, osm.node_id.size ()));
+            osm.node_id.push_back (e.attr ("id"));
+            osm.node_lon.push_back (parse_osm_coordinate (e.attr ("lon")));
+            osm.node_lat.push_back (parse_osm_coordinate (e.attr ("lat")));
+        } else if (e.name == "way" && !e.closing)
+        {
+            in_way = !e.self_closing;
+            way_is_area = false;
+            way_highway = way_oneway = way_oneway_bicycle = xml_span_t ();
+            way_ref_start = osm.refs.size ();
+        } else if (in_way && e.name == "nd")
+        {
+            osm.refs.push_back (parse_osm_id (e.attr ("ref")));
+        } else if (in_way && e.name == "tag")
+        {
+            const xml_span_t k = e.attr ("k");
+            if (k == "highway")
+                way_highway = e.attr ("v");
+            else if (k == "oneway")
+                way_oneway = e.attr ("v");
+            else if (k == "oneway:bicycle")
+                way_oneway_bicycle = e.attr ("v");
+            else if (k == "area")
+                way_is_area = e.attr ("v") == "yes";
+        } else if (in_way && e.name == "way" && e.closing)
+        {
+            in_way = false;
+            if (way_highway.empty () || way_is_area)
+                osm.refs.resize (way_ref_start);
+            else
+            {
+                osm.ref_offsets.push_back (osm.refs.size ());
+                osm.highway.push_back (way_highway);
+                osm.oneway.push_back (way_oneway);
+                osm.oneway_bicycle.push_back (way_oneway_bicycle);
+            }
+        }
+        if (p == end)
+            break;
+    }
+}
+
+//' rcpp_osm_xml_as_network
+//'
+//' Read the highways of an OSM XML file directly into a network
+//'
+//' @param file Path to an OSM XML file
+//' @param pr Rcpp::DataFrame containing the weighting profile
+//'
+//' @return Rcpp::List of the same network matrices as returned by
+//' \code{rcpp_lines_as_network}
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::List rcpp_osm_xml_as_network (std::string file, Rcpp::DataFrame pr)
+{
+    highway_table_t hw_table (
+            Rcpp::as <std::vector <std::string> > (pr [1]),
+            Rcpp::as <std::vector <double> > (pr [2]));
+
+    mapped_file_t xml (file);
+    osm_highways_t osm;
+    read_osm_highways (xml.begin (), xml.end (), osm);
+
+    // Gather the coordinates of each way contiguously. Nodes missing from
+    // the file, as at the edges of extracts, are dropped from their ways.
+    const size_t nways = osm.nways ();
+    std::vector <size_t> way_nodes, way_start (nways + 1, 0);
+    way_nodes.reserve (osm.refs.size ());
+    for (size_t w = 0; w < nways; w++)
+    {
+        for (size_t r = osm.ref_offsets [w]; r < osm.ref_offsets [w + 1]; r++)
+        {
+            auto n = osm.node_index.find (osm.refs [r]);
+            if (n != osm.node_index.end ())
+                way_nodes.push_back (n->second);
+        }
+        way_start [w + 1] = way_nodes.size ();
+    }
+    std::vector <double> lon (way_nodes.size ()), lat (way_nodes.size ());
+    for (size_t i = 0; i < way_nodes.size (); i++)
+    {
+        lon [i] = osm.node_lon [way_nodes [i]];
+        lat [i] = osm.node_lat [way_nodes [i]];
+    }
+
+    // oneway tags follow rcpp_lines_as_network, for which "oneway" is a
+    // column only when at least one way has the tag, and a missing value is
+    // filled from "oneway:bicycle"
+    bool has_oneway = false;
+    for (auto &ow : osm.oneway)
+        has_oneway = has_oneway || !ow.empty ();
+
+    network_lines_t lines;
+    for (size_t w = 0; w < nways; w++)
+    {
+        xml_span_t ow = osm.oneway [w];
+        if (ow.empty ())
+            ow = osm.oneway_bicycle [w];
+        const bool both_ways = has_oneway &&
+            !(ow == "yes" || ow == "-1");
+        lines.add (lon.data () + way_start [w], lat.data () + way_start [w],
+                (int) (way_start [w + 1] - way_start [w]), both_ways,
+                hw_table.class_of (osm.highway [w].str ()));
+    }
+    const size_t nrows = lines.nrows ();
+
+    Rcpp::NumericMatrix nmat = Rcpp::NumericMatrix (Rcpp::Dimension (nrows, 6));
+    Rcpp::CharacterMatrix idmat = Rcpp::CharacterMatrix (Rcpp::Dimension (nrows,
+                3));
+    fill_network_matrix (lines, hw_table.factors, nmat.begin ());
+
+    // Node IDs are R strings, so idmat is filled serially
+    for (size_t w = 0; w < nways; w++)
+    {
+        const std::string &hway = hw_table.names [lines.hw_class [w]];
+        size_t row = lines.offsets [w];
+        for (size_t i = way_start [w] + 1; i < way_start [w + 1]; i++)
+        {
+            const std::string id0 = osm.node_id [way_nodes [i - 1]].str ();
+            const std::string id1 = osm.node_id [way_nodes [i]].str ();
+            idmat (row, 0) = id0;
+            idmat (row, 1) = id1;
+            idmat (row, 2) = hway;
+            row ++;
+            if (lines.both_ways [w])
+            {
+                idmat (row, 0) = id1;
+                idmat (row, 1) = id0;
+                idmat (row, 2) = hway;
+                row ++;
+            }
+        }
+    }
+
+    Rcpp::List res (2);
+    res [0] = nmat;
+    res [1] = idmat;
+
+    return res;
+}
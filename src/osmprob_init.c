@@ -4,18 +4,48 @@
 #include <R_ext/Rdynload.h>
 
 /* .Call calls */
+extern SEXP osmprob_rcpp_engine_build_ch(SEXP);
+extern SEXP osmprob_rcpp_engine_create(SEXP);
+extern SEXP osmprob_rcpp_engine_distance_matrix(SEXP, SEXP, SEXP, SEXP);
+extern SEXP osmprob_rcpp_engine_expand_path(SEXP, SEXP);
+extern SEXP osmprob_rcpp_engine_map_edges(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP osmprob_rcpp_engine_nearest(SEXP, SEXP, SEXP, SEXP);
+extern SEXP osmprob_rcpp_engine_shortest_path(SEXP, SEXP, SEXP, SEXP);
 extern SEXP osmprob_rcpp_lines_as_network(SEXP, SEXP);
-extern SEXP osmprob_rcpp_make_compact_graph(SEXP);
+extern SEXP osmprob_rcpp_make_compact_graph(SEXP, SEXP, SEXP);
+extern SEXP osmprob_rcpp_nearest(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP osmprob_rcpp_osm_xml_as_network(SEXP, SEXP);
+extern SEXP osmprob_rcpp_prob_engine_create(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP osmprob_rcpp_prob_engine_route(SEXP, SEXP, SEXP);
+extern SEXP osmprob_rcpp_read_snapshot(SEXP);
 extern SEXP osmprob_rcpp_router(SEXP, SEXP, SEXP, SEXP);
-extern SEXP osmprob_rcpp_router_dijkstra(SEXP, SEXP, SEXP);
-extern SEXP osmprob_rcpp_router_prob(SEXP, SEXP, SEXP, SEXP);
+extern SEXP osmprob_rcpp_router_prob(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP osmprob_rcpp_router_rsp(SEXP, SEXP, SEXP, SEXP);
+extern SEXP osmprob_rcpp_router_rsp_flows(SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP osmprob_rcpp_router_rsp_sweep(SEXP, SEXP, SEXP, SEXP);
+extern SEXP osmprob_rcpp_write_snapshot(SEXP, SEXP);
 
 static const R_CallMethodDef CallEntries[] = {
-    {"osmprob_rcpp_lines_as_network",   (DL_FUNC) &osmprob_rcpp_lines_as_network,   2},
-    {"osmprob_rcpp_make_compact_graph", (DL_FUNC) &osmprob_rcpp_make_compact_graph, 1},
-    {"osmprob_rcpp_router",             (DL_FUNC) &osmprob_rcpp_router,             4},
-    {"osmprob_rcpp_router_dijkstra",    (DL_FUNC) &osmprob_rcpp_router_dijkstra,    3},
-    {"osmprob_rcpp_router_prob",        (DL_FUNC) &osmprob_rcpp_router_prob,        4},
+    {"osmprob_rcpp_engine_build_ch",        (DL_FUNC) &osmprob_rcpp_engine_build_ch,        1},
+    {"osmprob_rcpp_engine_create",          (DL_FUNC) &osmprob_rcpp_engine_create,          1},
+    {"osmprob_rcpp_engine_distance_matrix", (DL_FUNC) &osmprob_rcpp_engine_distance_matrix, 4},
+    {"osmprob_rcpp_engine_expand_path",     (DL_FUNC) &osmprob_rcpp_engine_expand_path,     2},
+    {"osmprob_rcpp_engine_map_edges",       (DL_FUNC) &osmprob_rcpp_engine_map_edges,       5},
+    {"osmprob_rcpp_engine_nearest",         (DL_FUNC) &osmprob_rcpp_engine_nearest,         4},
+    {"osmprob_rcpp_engine_shortest_path",   (DL_FUNC) &osmprob_rcpp_engine_shortest_path,   4},
+    {"osmprob_rcpp_lines_as_network",       (DL_FUNC) &osmprob_rcpp_lines_as_network,       2},
+    {"osmprob_rcpp_make_compact_graph",     (DL_FUNC) &osmprob_rcpp_make_compact_graph,     3},
+    {"osmprob_rcpp_nearest",                (DL_FUNC) &osmprob_rcpp_nearest,                5},
+    {"osmprob_rcpp_osm_xml_as_network",     (DL_FUNC) &osmprob_rcpp_osm_xml_as_network,     2},
+    {"osmprob_rcpp_prob_engine_create",     (DL_FUNC) &osmprob_rcpp_prob_engine_create,     6},
+    {"osmprob_rcpp_prob_engine_route",      (DL_FUNC) &osmprob_rcpp_prob_engine_route,      3},
+    {"osmprob_rcpp_read_snapshot",          (DL_FUNC) &osmprob_rcpp_read_snapshot,          1},
+    {"osmprob_rcpp_router",                 (DL_FUNC) &osmprob_rcpp_router,                 4},
+    {"osmprob_rcpp_router_prob",            (DL_FUNC) &osmprob_rcpp_router_prob,            6},
+    {"osmprob_rcpp_router_rsp",             (DL_FUNC) &osmprob_rcpp_router_rsp,             4},
+    {"osmprob_rcpp_router_rsp_flows",       (DL_FUNC) &osmprob_rcpp_router_rsp_flows,       5},
+    {"osmprob_rcpp_router_rsp_sweep",       (DL_FUNC) &osmprob_rcpp_router_rsp_sweep,       4},
+    {"osmprob_rcpp_write_snapshot",         (DL_FUNC) &osmprob_rcpp_write_snapshot,         2},
     {NULL, NULL, 0}
 };
 
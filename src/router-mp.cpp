@@ -31,6 +31,11 @@
 
 #include "router-mp.h"
 
+// Definitions of static members which are bound to references, as by
+// std::vector constructors, and so required in the absence of inlining
+const size_t router_engine_t::npos;
+const size_t rsp_router_t::npos;
+
 // TODO: Move all these back into header file
 
 /************************************************************************
@@ -46,13 +51,11 @@ void Graphmp::make_dq_mats ()
     /* the diagonal of d_mat is 0, otherwise the first row contains only one
      * finite entry for escape from start_node. The last column similarly
      * contains only one finite entry for absorption by end_node. */
-    static const unsigned num_vertices = return_num_vertices ();
+    const unsigned num_vertices = return_num_vertices ();
     //const unsigned start_node = return_start_node ();
     //const unsigned end_node = return_end_node ();
-    const unsigned dstart_node = std::distance (all_nodes.begin (),
-            all_nodes.find (return_start_node ()));
-    const unsigned dend_node = std::distance (all_nodes.begin (),
-            all_nodes.find (return_end_node ()));
+    const unsigned dstart_node = node_index (return_start_node ());
+    const unsigned dend_node = node_index (return_end_node ());
 
     d_mat = arma::mat (num_vertices + 1, num_vertices + 1);
     d_mat.fill (max_weight);
@@ -65,15 +68,15 @@ void Graphmp::make_dq_mats ()
     for (unsigned i=0; i<num_vertices; i++)
         q_sums [i] = 0;
 
-    for (auto const &it1 : adjlist)
+    for (size_t u=0; u<graph.nvertices; u++)
     {
-        const unsigned di = std::distance (all_nodes.begin (), 
-                all_nodes.find (it1.first));
-        for (auto const &it2 : it1.second)
+        if (graph.degree (u) == 0)
+            continue;
+        const unsigned di = node_pos [u];
+        for (size_t k=graph.offsets [u]; k<graph.offsets [u + 1]; k++)
         {
-            const unsigned dj = std::distance (all_nodes.begin (),
-                    all_nodes.find (it2.target));
-            d_mat (di + 1, dj + 1) = it2.weight;
+            const unsigned dj = node_pos [graph.targets [k]];
+            d_mat (di + 1, dj + 1) = graph.weights [k];
             q_mat (di + 1, dj + 1) = 1.0;
             q_sums [di]++;
         }
@@ -93,7 +96,6 @@ void Graphmp::make_dq_mats ()
     delete [] q_sums;
 }
 
-
 /************************************************************************
  ************************************************************************
  **                                                                    **
@@ -104,40 +106,379 @@ void Graphmp::make_dq_mats ()
 
 void Graphmp::make_n_mat ()
 {
-    // The most computationally expensive part of all, and the only place
-    // requiring matrix inversion. This is, however, only required once, and is
-    // not repeated within the convergence loop.
+    // The most computationally expensive part of all. (I - Q) is only
+    // factorised once, and is not repeated within the convergence loop. The
+    // explicit inverse is retained as SOLVER_INVERSE for comparison, but
+    // x_vec and v_vec only ever need N applied to a vector, which solve_n
+    // does through the factorisation.
     const unsigned n = return_num_vertices ();
+    base_dstart = node_index (return_start_node ());
+    base_dend = node_index (return_end_node ());
+    upd_rows.clear ();
+
+    if (is_sparse ())
+    {
+        iq_sp = identity_minus (q_sp);
+        if (return_solver () == SOLVER_LU)
+            iq_lu.factorise (iq_sp);
+        x_vec.zeros (n + 1);
+        v_vec.zeros (n + 1);
+        return;
+    }
 
     arma::mat unit_mat (n + 1, n + 1, arma::fill::eye);
-    n_mat = (unit_mat - q_mat).i();
+    if (return_solver () == SOLVER_INVERSE)
+        n_mat = (unit_mat - q_mat).i();
+    else
+    {
+        if (!arma::lu (lu_l, lu_u, lu_p, unit_mat - q_mat))
+            throw std::runtime_error ("LU decomposition of (I - Q) failed");
+        // Row i of the permutation matrix has its single 1 in column
+        // lu_perm [i], so that P b is gathered without a matrix product.
+        lu_perm.resize (n + 1);
+        for (arma::uword j=0; j<=n; j++)
+        {
+            const double *p = lu_p.colptr (j);
+            for (arma::uword i=0; i<=n; i++)
+                if (p [i] != 0.0)
+                    lu_perm [i] = j;
+        }
+    }
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                              SOLVE_N                               **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+void Graphmp::solve_n (const arma::vec &b, arma::vec &x)
+{
+    // x = N' b for the current endpoints, from x = N b for those of the
+    // factorisation, as N' = N + N U (I - V' N U)^-1 V' N
+    solve_n_base (b, x);
+    const size_t k = upd_rows.size ();
+    if (k == 0)
+        return;
+    const arma::uword n = x.n_elem;
+    const double *xp = x.memptr ();
+    upd_t.assign (k, 0.0);
+    for (size_t j=0; j<k; j++)
+    {
+        const double *v = upd_v.data () + j * n;
+        double t = 0.0;
+        for (arma::uword i=0; i<n; i++)
+            t += v [i] * xp [i];
+        for (size_t r=0; r<k; r++)
+            upd_t [r] += upd_cinv [r + j * k] * t;
+    }
+    for (size_t r=0; r<k; r++)
+    {
+        const double *nu = upd_nu.data () + r * n;
+        for (arma::uword i=0; i<n; i++)
+            x [i] += nu [i] * upd_t [r];
+    }
 }
 
+void Graphmp::solve_n_base (const arma::vec &b, arma::vec &x)
+{
+    // x = N b = (I - Q)^-1 b for the (I - Q) formed by make_n_mat, or for
+    // the current Q with SOLVER_BICGSTAB. Iterative solves are warm-started
+    // from the incoming contents of x.
+    if (!is_sparse ())
+    {
+        if (return_solver () == SOLVER_INVERSE)
+            x = n_mat * b;
+        else
+        {
+            // L U x = P b, by forward and then back substitution in place
+            // in x, traversing the columns of the unit lower triangular L
+            // and the upper triangular U
+            const arma::uword n = b.n_elem;
+            x.set_size (n);
+            const double *bp = b.memptr ();
+            double *xp = x.memptr ();
+            for (arma::uword i=0; i<n; i++)
+                xp [i] = bp [lu_perm [i]];
+            for (arma::uword j=0; j<n; j++)
+            {
+                const double xj = xp [j];
+                if (xj == 0.0)
+                    continue;
+                const double *l = lu_l.colptr (j);
+                for (arma::uword i=j+1; i<n; i++)
+                    xp [i] -= l [i] * xj;
+            }
+            for (arma::uword j=n; j-- > 0; )
+            {
+                const double *u = lu_u.colptr (j);
+                const double xj = (xp [j] /= u [j]);
+                if (xj == 0.0)
+                    continue;
+                for (arma::uword i=0; i<j; i++)
+                    xp [i] -= u [i] * xj;
+            }
+        }
+    } else if (return_solver () == SOLVER_LU)
+    {
+        x.set_size (b.n_elem);
+        iq_lu.solve (b.memptr (), x.memptr (), solve_work);
+    } else
+    {
+        const unsigned max_iter = 10 * b.n_elem + 100;
+        if (x.n_elem != b.n_elem)
+            x.zeros (b.n_elem);
+        if (bicgstab (iq_sp, b.memptr (), x.memptr (), 1.0e-12, max_iter,
+                    bicgstab_work) > max_iter)
+            throw std::runtime_error (
+                    "Sparse solve for (I - Q) did not converge");
+    }
+}
 
 /************************************************************************
  ************************************************************************
  **                                                                    **
- **                           MAKE_HXV_VECS                            **
+ **                           INITIAL_Q_ROW                            **
  **                                                                    **
  ************************************************************************
  ************************************************************************/
 
-void Graphmp::make_hxv_vecs ()
+void Graphmp::initial_q_row (unsigned row, unsigned dstart, unsigned dend,
+        std::vector <double> &q)
 {
-    arma::mat lq = -arma::log (q_mat.t ());
-    // q_mat has zeros, so log (q) has non-finite values which are here reset to
-    // zero so they don't contribute to the resultant sums.
-    lq.elem (arma::find_nonfinite (lq)).zeros ();
-    arma::mat temp_mat = q_mat * lq; // arma requires this intermediate stage
-    h_vec = temp_mat.diag ();
-    x_vec = n_mat * h_vec;
+    // Row of the initial Q, as set by make_dq_mats, for the start and end
+    // nodes at rows dstart + 1 and dend + 1. Repeated edges are assigned
+    // rather than summed, but each counts towards the degree.
+    q.assign (return_num_vertices () + 1, 0.0);
+    if (row == 0)
+    {
+        q [dstart + 1] = 1.0;
+        return;
+    }
+    const vertex_t u = node_ids [row - 1];
+    const double deg = (double) graph.degree (u);
+    double qval = (deg > 0.0) ? 1.0 / deg : 0.0;
+    if (row == dend + 1)
+        qval *= deg / (deg + 1.0);
+    for (size_t k=graph.offsets [u]; k<graph.offsets [u + 1]; k++)
+        q [node_pos [graph.targets [k]] + 1] = qval;
+}
 
-    arma::mat dtemp = d_mat;
-    dtemp.elem (arma::find_nonfinite (dtemp)).zeros ();
-    temp_mat = q_mat * dtemp.t ();
-    v_vec = n_mat * temp_mat.diag ();
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                           SET_ENDPOINTS                            **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+void Graphmp::set_endpoints (vertex_t start_node, vertex_t end_node)
+{
+    // Q and D are rebuilt for the new endpoints at the cost of filling them,
+    // while (I - Q) is neither refactorised nor inverted again: solve_n
+    // corrects solves with the factorisation of the base endpoints by the
+    // rows of Q which differ from those of the base. BiCGSTAB needs no
+    // factorisation, and simply iterates with the new (I - Q).
+    const unsigned dstart = node_index (start_node);
+    const unsigned dend = node_index (end_node);
+    _start_node = start_node;
+    _end_node = end_node;
+    const unsigned n = return_num_vertices ();
+    if (is_sparse ())
+    {
+        make_dq_sp_mats ();
+        iq_sp = identity_minus (q_sp);
+    } else
+        make_dq_mats ();
+    x_vec.zeros (n + 1);
+    v_vec.zeros (n + 1);
+    upd_rows.clear ();
+    if (is_sparse () && return_solver () == SOLVER_BICGSTAB)
+        return;
+
+    if (dstart != base_dstart)
+        upd_rows.push_back (0);
+    if (dend != base_dend)
+    {
+        upd_rows.push_back (base_dend + 1);
+        upd_rows.push_back (dend + 1);
+    }
+    const size_t k = upd_rows.size ();
+    upd_v.resize (k * (n + 1));
+    upd_nu.resize (k * (n + 1));
+    std::vector <double> q_new, q_base;
+    arma::vec e_row (n + 1), nu_col;
+    for (size_t j=0; j<k; j++)
+    {
+        initial_q_row (upd_rows [j], dstart, dend, q_new);
+        initial_q_row (upd_rows [j], base_dstart, base_dend, q_base);
+        for (unsigned i=0; i<=n; i++)
+            upd_v [i + j * (n + 1)] = q_new [i] - q_base [i];
+
+        e_row.zeros ();
+        e_row [upd_rows [j]] = 1.0;
+        solve_n_base (e_row, nu_col);
+        std::copy (nu_col.memptr (), nu_col.memptr () + n + 1,
+                upd_nu.begin () + j * (n + 1));
+    }
+
+    // (I - V' N U)^-1 by Gauss-Jordan elimination with partial pivoting,
+    // with c and upd_cinv both column-major. (I - Q) is non-singular only
+    // if c is too.
+    std::vector <double> c (k * k);
+    upd_cinv.assign (k * k, 0.0);
+    for (size_t a=0; a<k; a++)
+    {
+        upd_cinv [a + a * k] = 1.0;
+        for (size_t b=0; b<k; b++)
+        {
+            const double *v = upd_v.data () + a * (n + 1);
+            const double *nu = upd_nu.data () + b * (n + 1);
+            double s = (a == b) ? 1.0 : 0.0;
+            for (unsigned i=0; i<=n; i++)
+                s -= v [i] * nu [i];
+            c [a + b * k] = s;
+        }
+    }
+    for (size_t p=0; p<k; p++)
+    {
+        size_t piv = p;
+        for (size_t r=p+1; r<k; r++)
+            if (std::fabs (c [r + p * k]) > std::fabs (c [piv + p * k]))
+                piv = r;
+        if (!(std::fabs (c [piv + p * k]) > 1.0e-10))
+        {
+            // The update is ill-conditioned, so (I - Q) is instead
+            // factorised afresh, with these endpoints as the new base
+            make_n_mat ();
+            return;
+        }
+        for (size_t col=0; col<k; col++)
+        {
+            std::swap (c [p + col * k], c [piv + col * k]);
+            std::swap (upd_cinv [p + col * k], upd_cinv [piv + col * k]);
+        }
+        const double d = c [p + p * k];
+        for (size_t col=0; col<k; col++)
+        {
+            c [p + col * k] /= d;
+            upd_cinv [p + col * k] /= d;
+        }
+        for (size_t r=0; r<k; r++)
+        {
+            const double f = c [r + p * k];
+            if (r == p || f == 0.0)
+                continue;
+            for (size_t col=0; col<k; col++)
+            {
+                c [r + col * k] -= f * c [p + col * k];
+                upd_cinv [r + col * k] -= f * upd_cinv [p + col * k];
+            }
+        }
+    }
 }
 
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                             MAKE_Q_CSR                             **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+void Graphmp::make_q_csr ()
+{
+    // The non-zero entries of each row of q_mat in order of column, found by
+    // a counting sort over its columns. Non-finite distances are held as
+    // zero, so that they contribute nothing to v_vec.
+    const arma::uword n = q_mat.n_rows;
+    q_csr.nrows = d_csr.nrows = n;
+    q_csr.row_ptr.assign (n + 1, 0);
+    for (arma::uword j=0; j<n; j++)
+    {
+        const double *q = q_mat.colptr (j);
+        for (arma::uword i=0; i<n; i++)
+            if (q [i] != 0.0)
+                q_csr.row_ptr [i + 1]++;
+    }
+    for (arma::uword i=0; i<n; i++)
+        q_csr.row_ptr [i + 1] += q_csr.row_ptr [i];
+
+    const size_t nnz = q_csr.row_ptr [n];
+    q_csr.col.resize (nnz);
+    q_csr.val.resize (nnz);
+    d_csr.val.resize (nnz);
+    std::vector <size_t> pos (q_csr.row_ptr.begin (),
+            q_csr.row_ptr.end () - 1);
+    for (arma::uword j=0; j<n; j++)
+    {
+        const double *q = q_mat.colptr (j);
+        const double *d = d_mat.colptr (j);
+        for (arma::uword i=0; i<n; i++)
+            if (q [i] != 0.0)
+            {
+                const size_t k = pos [i]++;
+                q_csr.col [k] = j;
+                q_csr.val [k] = q [i];
+                d_csr.val [k] = std::isfinite (d [i]) ? d [i] : 0.0;
+            }
+    }
+    d_csr.row_ptr = q_csr.row_ptr;
+    d_csr.col = q_csr.col;
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                           MAKE_HXV_ROWS                            **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+void Graphmp::make_hxv_rows (const csr_mat_t &q, const csr_mat_t &d)
+{
+    // h_vec and the right-hand side of v_vec are the diagonals of
+    // Q (-log Q') and Q D', which reduce to row-wise sums of -q log (q) and
+    // of q d over the stored entries of Q which are still positive. Zeros of
+    // Q, for which log (q) is not finite, contribute nothing. d shares the
+    // sparsity pattern of q.
+    const size_t n = q.nrows;
+    h_vec.zeros (n);
+    v_rhs.zeros (n);
+    for (size_t i=0; i<n; i++)
+    {
+        double h = 0.0, r = 0.0;
+        for (size_t k=q.row_ptr [i]; k<q.row_ptr [i + 1]; k++)
+        {
+            const double qk = q.val [k];
+            if (qk > 0.0)
+            {
+                h -= qk * std::log (qk);
+                r += qk * d.val [k];
+            }
+        }
+        h_vec [i] = h;
+        v_rhs [i] = r;
+    }
+
+    solve_n (h_vec, x_vec);
+    solve_n (v_rhs, v_vec);
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                           MAKE_HXV_VECS                            **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+void Graphmp::make_hxv_vecs ()
+{
+    make_hxv_rows (q_csr, d_csr);
+}
 
 /************************************************************************
  ************************************************************************
@@ -147,30 +488,133 @@ void Graphmp::make_hxv_vecs ()
  ************************************************************************
  ************************************************************************/
 
-void Graphmp::iterate_q_mat ()
+double Graphmp::iterate_q_mat ()
 {
-    const double eta_inv = 1.0 / return_eta ();
-    const arma::rowvec x_row = arma::conv_to <arma::rowvec>::from (x_vec),
-          v_row = arma::conv_to <arma::rowvec>::from (v_vec);
+    // Only the entries held in q_csr are updated, as all others of q_mat
+    // remain zero, and they are then copied back into q_mat. Returns the
+    // summed absolute change in Q.
+    const double delta = boltzmann_update (q_csr, x_vec.memptr (),
+            v_vec.memptr (), 1.0 / return_eta (), q_next);
+    q_csr.val.swap (q_next);
+    for (size_t i=0; i<q_csr.nrows; i++)
+        for (size_t k=q_csr.row_ptr [i]; k<q_csr.row_ptr [i + 1]; k++)
+            q_mat.at (i, q_csr.col [k]) = q_csr.val [k];
 
-    // TODO: Use arma::sum to get row sums and avoid looping over rows?
-    // - this would require making matrices of x_vec and v_vec, so may not be
-    // any quicker?
-    q_mat.replace (0.0, max_weight);
-    for (arma::uword r=0; r<q_mat.n_rows; ++r)
+    return delta;
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                           MAKE_DQ_SP_MATS                          **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+void Graphmp::make_dq_sp_mats ()
+{
+    /* Sparse equivalent of make_dq_mats: only entries corresponding to actual
+     * edges (plus the single escape from the injected row 0) are stored, and
+     * d_sp holds the edge weights on exactly the same pattern as q_sp. Row 0
+     * and the absorbing end_node row are treated as in the dense version. */
+    const unsigned num_vertices = return_num_vertices ();
+    const unsigned dstart_node = node_index (return_start_node ());
+    const unsigned dend_node = node_index (return_end_node ());
+
+    q_sp.nrows = d_sp.nrows = num_vertices + 1;
+    q_sp.row_ptr.assign (num_vertices + 2, 0);
+    q_sp.col.clear ();
+    q_sp.val.clear ();
+    d_sp.val.clear ();
+
+    q_sp.col.push_back (dstart_node + 1);
+    q_sp.val.push_back (1.0);
+    d_sp.val.push_back (1.0);
+    q_sp.row_ptr [1] = 1;
+
+    // node_ids is ordered by vertex ID, so rows are filled in sequence.
+    std::vector <std::pair <size_t, weight_t> > row;
+    for (unsigned di=0; di<num_vertices; di++)
     {
-        //arma::rowvec temp_row = q_mat.row (r);
-        //arma::rowvec temp_row = q_mat.row (r);
-        //temp_row.replace (0.0, max_weight);
-        //temp_row = arma::exp (-eta_inv * (temp_row + v_row) + x_row);
-        arma::rowvec temp_row = arma::exp (-eta_inv * (q_mat.row (r) + 
-                    v_row) + x_row);
-        const double rsum = arma::sum (temp_row);
-        if (rsum > 0.0)
-            q_mat.row (r) = temp_row / rsum;
-        else
-            q_mat.row (r) = temp_row.zeros ();
+        const vertex_t id = node_ids [di];
+        row.clear ();
+        for (size_t k=graph.offsets [id]; k<graph.offsets [id + 1]; k++)
+            row.push_back (std::make_pair (
+                        (size_t) node_pos [graph.targets [k]] + 1,
+                        graph.weights [k]));
+        const unsigned q_sum = row.size ();
+        // Duplicated edges yield one matrix entry holding the last weight, but
+        // are counted in q_sum, matching the dense assignments.
+        std::stable_sort (row.begin (), row.end (),
+                [] (const std::pair <size_t, weight_t> &a,
+                    const std::pair <size_t, weight_t> &b) {
+                    return a.first < b.first; });
+        double qval = (q_sum > 0) ? 1.0 / (double) q_sum : 0.0;
+        if (di == dend_node)
+            qval *= q_sum / (q_sum + 1.0);
+        for (unsigned k=0; k<row.size (); k++)
+        {
+            if (k + 1 < row.size () && row [k + 1].first == row [k].first)
+                continue;
+            q_sp.col.push_back (row [k].first);
+            q_sp.val.push_back (qval);
+            d_sp.val.push_back (row [k].second);
+        }
+        q_sp.row_ptr [di + 2] = q_sp.val.size ();
     }
+    d_sp.row_ptr = q_sp.row_ptr;
+    d_sp.col = q_sp.col;
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                          MAKE_HXV_SP_VECS                          **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+void Graphmp::make_hxv_sp_vecs ()
+{
+    make_hxv_rows (q_sp, d_sp);
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                          ITERATE_Q_SP_MAT                          **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+double Graphmp::iterate_q_sp_mat ()
+{
+    // Returns the summed absolute change in Q, as for the dense version
+    const double delta = boltzmann_update (q_sp, x_vec.memptr (),
+            v_vec.memptr (), 1.0 / return_eta (), q_next);
+    q_sp.val.swap (q_next);
+
+    return delta;
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                               GET_Q                                **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+double Graphmp::get_q (vertex_t from, vertex_t to)
+{
+    // Transition probability between two vertex IDs, excluding the injected
+    // row and column 0.
+    const unsigned di = node_index (from);
+    const unsigned dj = node_index (to);
+    if (is_sparse ())
+        return q_sp.get (di + 1, dj + 1);
+    else
+        return q_mat (di + 1, dj + 1);
 }
 
 /************************************************************************
@@ -183,24 +627,30 @@ void Graphmp::iterate_q_mat ()
 
 unsigned Graphmp::calculate_q_mat (double tol, unsigned max_iter)
 {
+    // All storage used within the loop is held by the graph and reused, so
+    // that iterations after the first allocate nothing.
     unsigned nloops = 0; 
-
-    arma::mat q_mat_old;
+    if (!is_sparse ())
+        make_q_csr ();
 
     double delta = 1.0;
     while (delta > tol && nloops < max_iter)
     {
-        q_mat_old = q_mat;
-        make_hxv_vecs ();
-        iterate_q_mat ();
-        delta = arma::accu (arma::abs (q_mat_old - q_mat));
+        if (is_sparse ())
+        {
+            make_hxv_sp_vecs ();
+            delta = iterate_q_sp_mat ();
+        } else
+        {
+            make_hxv_vecs ();
+            delta = iterate_q_mat ();
+        }
         nloops++;
     }
 
     return nloops;
 }
 
-
 /************************************************************************
  ************************************************************************
  **                                                                    **
@@ -209,6 +659,31 @@ unsigned Graphmp::calculate_q_mat (double tol, unsigned max_iter)
  ************************************************************************
  ************************************************************************/
 
+solver_t solver_from_string (const std::string &solver)
+{
+    if (solver == "inverse")
+        return SOLVER_INVERSE;
+    else if (solver == "lu")
+        return SOLVER_LU;
+    else if (solver == "bicgstab")
+        return SOLVER_BICGSTAB;
+    throw std::runtime_error ("solver must be one of inverse, lu, bicgstab");
+}
+
+sp_method_t sp_method_from_string (const std::string &method)
+{
+    if (method == "dijkstra")
+        return SP_DIJKSTRA;
+    else if (method == "astar")
+        return SP_ASTAR;
+    else if (method == "bidirectional")
+        return SP_BIDIRECTIONAL;
+    else if (method == "ch")
+        return SP_CH;
+    throw std::runtime_error (
+            "method must be one of dijkstra, astar, bidirectional, ch");
+}
+
 //' rcpp_router
 //'
 //' Return OSM data in Simple Features format
@@ -265,6 +740,24 @@ Rcpp::NumericMatrix rcpp_router (Rcpp::DataFrame netdf,
     return res;
 }
 
+// Converge Q, and return it as a single vector matching the pairs of
+// xfr,xto, reading entries directly rather than through a dense copy with
+// named rows and columns.
+Rcpp::NumericVector converged_q (Graphmp &g)
+{
+    const unsigned max_iter = 1000000;
+    unsigned nloops = g.calculate_q_mat (1.0e-6, max_iter);
+    if (nloops > max_iter)
+        throw std::runtime_error ("Routing algorithm did not converge");
+
+    const std::vector <vertex_t> idfrom = g.return_idfrom ();
+    const std::vector <vertex_t> idto = g.return_idto ();
+    Rcpp::NumericVector q_vec (idfrom.size ());
+    for (unsigned i=0; i<idfrom.size (); i++)
+        q_vec [i] = g.get_q (idfrom [i], idto [i]);
+    return q_vec;
+}
+
 //' rcpp_router_prob
 //'
 //' Return a vector of traversing probabilities
@@ -273,13 +766,21 @@ Rcpp::NumericMatrix rcpp_router (Rcpp::DataFrame netdf,
 //' @param start_node Starting node for shortest path route
 //' @param end_node Ending node for shortest path route
 //' @param eta The entropy parameter
+//' @param sparse If \code{TRUE}, hold the transition and distance matrices in
+//' sparse form, so memory scales with the number of edges rather than the
+//' square of the number of vertices.
+//' @param solver How \code{(I - Q)} is solved: \code{"lu"} factorises it
+//' once (dense or sparse LU), \code{"inverse"} forms the explicit dense
+//' inverse, and \code{"bicgstab"} uses an iterative Krylov solver on the
+//' sparse matrices.
 //'
 //' @return Rcpp::NumericVector of traversing probabilities
 //'
 //' @noRd
 // [[Rcpp::export]]
 Rcpp::NumericVector rcpp_router_prob (Rcpp::DataFrame netdf,
-        long long start_node, long long end_node, double eta)
+        long long start_node, long long end_node, double eta,
+        bool sparse = false, std::string solver = "lu")
 {
     // Extract vectors from netmat and convert to std:: types
     Rcpp::NumericVector idfrom_rcpp = netdf ["xfr"];
@@ -293,75 +794,646 @@ Rcpp::NumericVector rcpp_router_prob (Rcpp::DataFrame netdf,
     Rcpp::NumericVector d_rcpp = netdf ["d"];
     std::vector <weight_t> d = Rcpp::as <std::vector <weight_t> > (d_rcpp);
 
-    Graphmp g (idfrom, idto, d, start_node, end_node, eta);
+    Graphmp g (idfrom, idto, d, start_node, end_node, eta, sparse,
+            solver_from_string (solver));
 
-    const unsigned max_iter = 1000000;
-    unsigned nloops = g.calculate_q_mat (1.0e-6, max_iter);
-    if (nloops > max_iter)
-        throw std::runtime_error ("Routing algorithm did not converge");
-    // q_mat then has to have first row and first col removed
-    const int s = g.q_mat.n_rows;
-    g.q_mat = g.q_mat.submat (1, 1, s - 1, s - 1);
-
-    // The OSM IDs are then inserted as row and col names, requiring conversion
-    // of arma::mat to Rcpp::NumericMatrix
-    Rcpp::NumericMatrix q_mat_out = 
-        Rcpp::as <Rcpp::NumericMatrix> (Rcpp::wrap (g.q_mat));
-    Rcpp::CharacterVector names;
-    for (auto i=g.all_nodes.begin (); i != g.all_nodes.end (); ++i)
-        names.push_back (std::to_string (*i));
-    Rcpp::rownames (q_mat_out) = names;
-    Rcpp::colnames (q_mat_out) = names;
-
-    // Finally, convert matrix to single vector matching the pairs of xfr,xto
-    Rcpp::NumericVector q_vec;
-    for (unsigned i=0; i<idfrom.size (); i++)
+    return converged_q (g);
+}
+
+//' rcpp_prob_engine_create
+//'
+//' Prepare a probabilistic router, to be queried repeatedly for different
+//' start and end nodes with \code{rcpp_prob_engine_route}
+//'
+//' @param netdf A \code{matrix} containing network connections
+//' @param start_node Starting node for the first route
+//' @param end_node Ending node for the first route
+//' @param eta The entropy parameter
+//' @param sparse If \code{TRUE}, hold the transition and distance matrices in
+//' sparse form, as for \code{rcpp_router_prob}
+//' @param solver How \code{(I - Q)} is solved, as for
+//' \code{rcpp_router_prob}
+//'
+//' @return External pointer to the router
+//'
+//' @noRd
+// [[Rcpp::export]]
+SEXP rcpp_prob_engine_create (Rcpp::DataFrame netdf,
+        long long start_node, long long end_node, double eta,
+        bool sparse = false, std::string solver = "lu")
+{
+    Rcpp::NumericVector idfrom_rcpp = netdf ["xfr"];
+    Rcpp::NumericVector idto_rcpp = netdf ["xto"];
+    Rcpp::NumericVector d_rcpp = netdf ["d"];
+
+    Rcpp::XPtr <Graphmp> engine (new Graphmp (
+                Rcpp::as <std::vector <vertex_t> > (idfrom_rcpp),
+                Rcpp::as <std::vector <vertex_t> > (idto_rcpp),
+                Rcpp::as <std::vector <weight_t> > (d_rcpp),
+                start_node, end_node, eta, sparse,
+                solver_from_string (solver)), true);
+
+    return engine;
+}
+
+//' rcpp_prob_engine_route
+//'
+//' Traversing probabilities between a new pair of start and end nodes
+//'
+//' @param engine External pointer from \code{rcpp_prob_engine_create}
+//' @param start_node Starting node for the route
+//' @param end_node Ending node for the route
+//'
+//' @return Rcpp::NumericVector of traversing probabilities, as from
+//' \code{rcpp_router_prob}
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::NumericVector rcpp_prob_engine_route (SEXP engine,
+        long long start_node, long long end_node)
+{
+    Rcpp::XPtr <Graphmp> ptr (engine);
+    if (ptr.get () == NULL)
+        throw std::runtime_error ("probabilistic router is no longer valid; "
+                "rebuild it with rcpp_prob_engine_create");
+    ptr->set_endpoints (start_node, end_node);
+
+    return converged_q (*ptr);
+}
+
+// Randomised shortest path router over the edges of netdf, whose node IDs
+// are interned in index
+rsp_router_t rsp_from_netdf (Rcpp::DataFrame netdf,
+        std::unordered_map <std::string, size_t> &index)
+{
+    std::vector <std::string> from_id =
+        Rcpp::as <std::vector <std::string> > (netdf ["xfr"]);
+    std::vector <std::string> to_id =
+        Rcpp::as <std::vector <std::string> > (netdf ["xto"]);
+    std::vector <double> d = Rcpp::as <std::vector <double> > (netdf ["d"]);
+    std::vector <double> d_weighted =
+        Rcpp::as <std::vector <double> > (netdf ["d_weighted"]);
+
+    const size_t nedges = from_id.size ();
+    std::vector <size_t> from (nedges), to (nedges);
+    for (size_t e = 0; e < nedges; e++)
     {
-        unsigned di = std::distance (g.all_nodes.begin (), 
-                g.all_nodes.find (idfrom [i]));
-        unsigned dj = std::distance (g.all_nodes.begin (), 
-                g.all_nodes.find (idto [i]));
-        q_vec.push_back (q_mat_out (di, dj));
+        from [e] = index.emplace (from_id [e], index.size ()).first->second;
+        to [e] = index.emplace (to_id [e], index.size ()).first->second;
     }
-    return q_vec;
+    return rsp_router_t (from, to, d, d_weighted, index.size ());
 }
 
-//' rcpp_router_dijkstra
+//' rcpp_router_rsp
 //'
-//' Return a vector containing the shortest path between two nodes on a graph
+//' Randomised shortest path densities and probabilities of traversal
 //'
-//' @param netdf A \code{data.frame} containing network connections
-//' @param start_node Starting node for shortest path route
-//' @param end_node Ending node for shortest path route
+//' @param netdf A \code{data.frame} of network connections, with columns
+//' \code{xfr} and \code{xto} of node IDs, and \code{d} and
+//' \code{d_weighted} of distances
+//' @param start_node Starting node for the route
+//' @param end_node Ending node for the route
+//' @param eta The entropy parameter
 //'
-//' @return \code{Rcpp::NumericVector} with node IDs
+//' @return \code{list} of the traversal densities (\code{dens}) and
+//' probabilities (\code{prob}) of each edge of \code{netdf}, which are
+//' \code{NA} if \code{end_node} can not be reached, and the expected
+//' distance of the route (\code{dist})
 //'
 //' @noRd
 // [[Rcpp::export]]
-Rcpp::NumericVector rcpp_router_dijkstra (Rcpp::DataFrame netdf, 
-        int start_node, int end_node)
+Rcpp::List rcpp_router_rsp (Rcpp::DataFrame netdf, std::string start_node,
+        std::string end_node, double eta)
 {
-    // Extract vectors from netmat and convert to std:: types
-    Rcpp::NumericVector idfrom_rcpp = netdf ["from_id"];
-    std::vector <vertex_t> idfrom = 
-        Rcpp::as <std::vector <vertex_t> > (idfrom_rcpp);
+    std::unordered_map <std::string, size_t> index;
+    rsp_router_t rsp = rsp_from_netdf (netdf, index);
+    auto start = index.find (start_node);
+    if (start == index.end ())
+        throw std::runtime_error ("start_node is not part of netdf");
+    auto end = index.find (end_node);
+    if (end == index.end ())
+        throw std::runtime_error ("end_node is not part of netdf");
 
-    Rcpp::NumericVector idto_rcpp = netdf ["to_id"];
-    std::vector <vertex_t> idto = 
-        Rcpp::as <std::vector <vertex_t> > (idto_rcpp);
+    rsp.set_eta (eta);
+    const bool reachable = rsp.route (start->second, end->second);
+
+    const size_t nedges = rsp.entry.size ();
+    Rcpp::NumericVector dens (nedges, NA_REAL), prob (nedges, NA_REAL);
+    if (reachable)
+        for (size_t e = 0; e < nedges; e++)
+        {
+            dens [e] = rsp.dens [rsp.entry [e]];
+            prob [e] = rsp.prob [rsp.entry [e]];
+        }
+
+    return Rcpp::List::create (Rcpp::Named ("dens") = dens,
+            Rcpp::Named ("prob") = prob,
+            Rcpp::Named ("dist") = rsp.distance);
+}
+
+//' rcpp_router_rsp_sweep
+//'
+//' Randomised shortest path densities and probabilities for each of several
+//' values of the entropy parameter
+//'
+//' @param netdf A \code{data.frame} of network connections, as for
+//' \code{rcpp_router_rsp}
+//' @param start_node Starting node for the route
+//' @param end_node Ending node for the route
+//' @param eta Vector of values of the entropy parameter
+//'
+//' @return \code{list} of matrices of the traversal densities (\code{dens})
+//' and probabilities (\code{prob}), with one row for each edge of
+//' \code{netdf} and one column for each value of \code{eta}, and the vector
+//' of expected distances (\code{dist}), as for \code{rcpp_router_rsp}
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::List rcpp_router_rsp_sweep (Rcpp::DataFrame netdf,
+        std::string start_node, std::string end_node, std::vector <double> eta)
+{
+    std::unordered_map <std::string, size_t> index;
+    rsp_router_t rsp = rsp_from_netdf (netdf, index);
+    auto start = index.find (start_node);
+    if (start == index.end ())
+        throw std::runtime_error ("start_node is not part of netdf");
+    auto end = index.find (end_node);
+    if (end == index.end ())
+        throw std::runtime_error ("end_node is not part of netdf");
 
+    // Values of eta run in parallel, each thread with its own copy of the
+    // router, all sharing the symbolic analysis of (I - W), so that each
+    // value only refactorises. The copies are made here, where exceptions
+    // may still be thrown. Exceptions may not leave a parallel region, so
+    // they are only recorded there, and that of the first value of eta to
+    // fail is rethrown after it.
+    rsp.analyse ();
+    const size_t nedges = rsp.entry.size (), neta = eta.size ();
+    std::vector <double> dens_all (nedges * neta, NA_REAL),
+        prob_all (nedges * neta, NA_REAL), dist (neta);
+    const int nthreads = max_threads ();
+    std::vector <rsp_router_t> routers (nthreads, rsp);
+    std::exception_ptr error;
+    long error_eta = -1;
+    #pragma omp parallel num_threads (nthreads)
+    {
+        rsp_router_t &local = routers [thread_num ()];
+        // signed loop index for OpenMP 2.0
+        #pragma omp for schedule (dynamic)
+        for (long i = 0; i < (long) neta; i++)
+        {
+            try
+            {
+                local.set_eta (eta [i]);
+                if (local.route (start->second, end->second))
+                    for (size_t e = 0; e < nedges; e++)
+                    {
+                        const size_t k = local.entry [e];
+                        dens_all [e + i * nedges] = local.dens [k];
+                        prob_all [e + i * nedges] = local.prob [k];
+                    }
+                dist [i] = local.distance;
+            } catch (...)
+            {
+                #pragma omp critical
+                if (!error || i < error_eta)
+                {
+                    error = std::current_exception ();
+                    error_eta = i;
+                }
+            }
+        }
+    }
+    if (error)
+        std::rethrow_exception (error);
+
+    Rcpp::NumericMatrix dens (nedges, neta), prob (nedges, neta);
+    std::copy (dens_all.begin (), dens_all.end (), dens.begin ());
+    std::copy (prob_all.begin (), prob_all.end (), prob.begin ());
+
+    return Rcpp::List::create (Rcpp::Named ("dens") = dens,
+            Rcpp::Named ("prob") = prob,
+            Rcpp::Named ("dist") = Rcpp::wrap (dist));
+}
+
+//' rcpp_router_rsp_flows
+//'
+//' Summed randomised shortest path densities of many routes
+//'
+//' @param netdf A \code{data.frame} of network connections, as for
+//' \code{rcpp_router_rsp}
+//' @param from Vector of starting nodes
+//' @param to Vector of ending nodes, of the same length as \code{from}
+//' @param weight Vector of the number of trips along each route
+//' @param eta The entropy parameter
+//'
+//' @return \code{list} of the summed densities of all routes, multiplied
+//' by their weights, along each edge of \code{netdf} (\code{flow}), and the
+//' expected distance of each route, or \code{NA} if it can not be completed
+//' (\code{dist})
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::List rcpp_router_rsp_flows (Rcpp::DataFrame netdf,
+        std::vector <std::string> from, std::vector <std::string> to,
+        std::vector <double> weight, double eta)
+{
+    if (to.size () != from.size () || weight.size () != from.size ())
+        throw std::runtime_error ("from, to and weight differ in length");
+    std::unordered_map <std::string, size_t> index;
+    rsp_router_t rsp = rsp_from_netdf (netdf, index);
+    rsp.set_eta (eta);
+
+    // Routes are grouped by their end nodes, as each end node requires its
+    // own factorisation
+    const size_t nroutes = from.size ();
+    std::vector <size_t> origin (nroutes);
+    std::unordered_map <size_t, std::vector <size_t> > by_end;
+    for (size_t r = 0; r < nroutes; r++)
+    {
+        auto s = index.find (from [r]);
+        if (s == index.end ())
+            throw std::runtime_error ("from is not part of netdf");
+        auto t = index.find (to [r]);
+        if (t == index.end ())
+            throw std::runtime_error ("to is not part of netdf");
+        origin [r] = s->second;
+        by_end [t->second].push_back (r);
+    }
+    // Groups are ordered by end node, so that results do not depend on the
+    // order of the hash table
+    std::vector <std::pair <size_t, std::vector <size_t> > > groups (
+            by_end.begin (), by_end.end ());
+    std::sort (groups.begin (), groups.end ());
+
+    // Groups run in parallel, each thread with its own copy of the router
+    // for the factorisations, sharing their symbolic analysis, and its own
+    // sum of flows. These are all allocated here, where exceptions may
+    // still be thrown, and the sums are reduced in order of thread after
+    // the parallel region. With a static schedule, the flows are then the
+    // same from one run to the next for any given number of threads.
+    // Exceptions may not leave a parallel region, so they are only recorded
+    // there, and that of the first group to fail is rethrown after it.
+    std::vector <double> dist (nroutes);
+    rsp.analyse ();
+    const int nthreads = max_threads ();
+    std::vector <rsp_router_t> routers (nthreads, rsp);
+    std::vector <std::vector <double> > thread_flow (nthreads,
+            std::vector <double> (rsp.w.val.size (), 0.0));
+    std::exception_ptr error;
+    long error_group = -1;
+    #pragma omp parallel num_threads (nthreads)
+    {
+        rsp_router_t &local = routers [thread_num ()];
+        std::vector <double> &local_flow = thread_flow [thread_num ()];
+        std::vector <size_t> origins;
+        std::vector <double> weights, d;
+        // signed loop index for OpenMP 2.0
+        #pragma omp for schedule (static, 1)
+        for (long g = 0; g < (long) groups.size (); g++)
+        {
+            try
+            {
+                const std::vector <size_t> &routes = groups [g].second;
+                origins.resize (routes.size ());
+                weights.resize (routes.size ());
+                d.resize (routes.size ());
+                for (size_t i = 0; i < routes.size (); i++)
+                {
+                    origins [i] = origin [routes [i]];
+                    weights [i] = weight [routes [i]];
+                }
+                local.add_flows (groups [g].first, origins.data (),
+                        weights.data (), routes.size (), local_flow,
+                        d.data ());
+                for (size_t i = 0; i < routes.size (); i++)
+                    dist [routes [i]] = d [i];
+            } catch (...)
+            {
+                #pragma omp critical
+                if (!error || g < error_group)
+                {
+                    error = std::current_exception ();
+                    error_group = g;
+                }
+            }
+        }
+    }
+    if (error)
+        std::rethrow_exception (error);
+
+    std::vector <double> flow (rsp.w.val.size (), 0.0);
+    for (int t = 0; t < nthreads; t++)
+        for (size_t k = 0; k < flow.size (); k++)
+            flow [k] += thread_flow [t] [k];
+
+    const size_t nedges = rsp.entry.size ();
+    Rcpp::NumericVector edge_flow (nedges), route_dist (nroutes);
+    for (size_t e = 0; e < nedges; e++)
+        edge_flow [e] = flow [rsp.entry [e]];
+    for (size_t r = 0; r < nroutes; r++)
+        route_dist [r] = std::isnan (dist [r]) ? NA_REAL : dist [r];
+
+    return Rcpp::List::create (Rcpp::Named ("flow") = edge_flow,
+            Rcpp::Named ("dist") = route_dist);
+}
+
+//' rcpp_engine_create
+//'
+//' Prepare a router engine from the compact graph, to be queried repeatedly
+//' with \code{rcpp_engine_shortest_path}
+//'
+//' @param netdf A \code{data.frame} of the compact graph, with \code{character}
+//' columns \code{from_id} and \code{to_id}, \code{d_weighted}, and optionally
+//' the coordinates \code{from_lon}, \code{from_lat}, \code{to_lon} and
+//' \code{to_lat} needed for A* searches
+//'
+//' @return External pointer to the engine
+//'
+//' @noRd
+// [[Rcpp::export]]
+SEXP rcpp_engine_create (Rcpp::DataFrame netdf)
+{
+    Rcpp::CharacterVector from_rcpp = netdf ["from_id"];
+    Rcpp::CharacterVector to_rcpp = netdf ["to_id"];
     Rcpp::NumericVector d_rcpp = netdf ["d_weighted"];
-    std::vector <weight_t> d = Rcpp::as <std::vector <weight_t> > (d_rcpp);
 
-    const unsigned start_nodei = (unsigned) start_node;
-    const unsigned end_nodei = (unsigned) end_node;
+    Rcpp::XPtr <router_engine_t> engine (new router_engine_t (
+                Rcpp::as <std::vector <std::string> > (from_rcpp),
+                Rcpp::as <std::vector <std::string> > (to_rcpp),
+                Rcpp::as <std::vector <weight_t> > (d_rcpp)), true);
 
-    Graphmp g (idfrom, idto, d, start_nodei, end_nodei);
+    if (netdf.containsElementNamed ("from_lon"))
+    {
+        Rcpp::NumericVector from_lon = netdf ["from_lon"];
+        Rcpp::NumericVector from_lat = netdf ["from_lat"];
+        Rcpp::NumericVector to_lon = netdf ["to_lon"];
+        Rcpp::NumericVector to_lat = netdf ["to_lat"];
+        engine->graph.set_coordinates (
+                Rcpp::as <std::vector <double> > (from_lon),
+                Rcpp::as <std::vector <double> > (from_lat),
+                Rcpp::as <std::vector <double> > (to_lon),
+                Rcpp::as <std::vector <double> > (to_lat));
+    }
 
-    std::vector <weight_t> min_distance;
-    std::vector <vertex_t> previous;
-    g.Dijkstra (start_nodei, min_distance, previous);
+    return engine;
+}
+
+// Engine behind an external pointer, which is NULL once restored from a saved
+// workspace
+router_engine_t &engine_from_sexp (SEXP engine)
+{
+    Rcpp::XPtr <router_engine_t> ptr (engine);
+    if (ptr.get () == NULL)
+        throw std::runtime_error ("router engine is no longer valid; "
+                "rebuild it with prepare_router");
+    return *ptr;
+}
+
+//' rcpp_engine_build_ch
+//'
+//' Build the contraction hierarchy of a router engine
+//'
+//' @param engine External pointer from \code{rcpp_engine_create}
+//'
+//' @return Number of shortcuts added to the graph
+//'
+//' @noRd
+// [[Rcpp::export]]
+double rcpp_engine_build_ch (SEXP engine)
+{
+    router_engine_t &eng = engine_from_sexp (engine);
+    eng.build_ch ();
+    return (double) eng.ch.nshortcuts;
+}
+
+//' rcpp_engine_shortest_path
+//'
+//' Shortest path between two vertices of a prepared router engine
+//'
+//' @param engine External pointer from \code{rcpp_engine_create}
+//' @param start_node ID of the start vertex in the compact graph
+//' @param end_node ID of the end vertex in the compact graph
+//' @param method One of \code{"dijkstra"}, \code{"astar"},
+//' \code{"bidirectional"} or \code{"ch"}
+//'
+//' @return \code{Rcpp::List} with the compact graph vertex IDs of the
+//' \code{path} and the number of vertices \code{settled} by the search
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::List rcpp_engine_shortest_path (SEXP engine, std::string start_node,
+        std::string end_node, std::string method = "dijkstra")
+{
+    router_engine_t &eng = engine_from_sexp (engine);
+    const sp_method_t sp_method = sp_method_from_string (method);
+
+    const vertex_t source = eng.lookup (start_node, "start_node");
+    const vertex_t target = eng.lookup (end_node, "end_node");
+
+    size_t nsettled;
+    std::vector <vertex_t> path = eng.shortest_path (source, target,
+            sp_method, nsettled);
+
+    Rcpp::CharacterVector path_ids (path.size ());
+    for (size_t i = 0; i < path.size (); i++)
+        path_ids [i] = eng.ids [path [i]];
+
+    return Rcpp::List::create (Rcpp::Named ("path") = path_ids,
+            Rcpp::Named ("settled") = (double) nsettled);
+}
+
+//' rcpp_engine_distance_matrix
+//'
+//' Shortest path distances between all pairs of sources and targets
+//'
+//' @param engine External pointer from \code{rcpp_engine_create}
+//' @param from IDs of the source vertices in the compact graph
+//' @param to IDs of the target vertices in the compact graph
+//' @param predecessors If \code{TRUE}, also return the shortest path tree of
+//' each source
+//'
+//' @return \code{Rcpp::List} with the \code{(from x to)} matrix of distances
+//' \code{d}, and if \code{predecessors}, the \code{(from x ids)} matrix
+//' \code{pred} of predecessor indices into the vertex IDs \code{ids} (or
+//' \code{NA} for the source and unreached vertices)
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::List rcpp_engine_distance_matrix (SEXP engine,
+        std::vector <std::string> from, std::vector <std::string> to,
+        bool predecessors = false)
+{
+    router_engine_t &eng = engine_from_sexp (engine);
+    std::vector <vertex_t> sources (from.size ()), targets (to.size ());
+    for (size_t i = 0; i < from.size (); i++)
+        sources [i] = eng.lookup (from [i], "from");
+    for (size_t i = 0; i < to.size (); i++)
+        targets [i] = eng.lookup (to [i], "to");
+
+    std::vector <weight_t> d;
+    std::vector <vertex_t> pred;
+    eng.graph.distance_matrix (sources, targets, d,
+            predecessors ? &pred : NULL);
+
+    Rcpp::NumericMatrix dmat (from.size (), to.size ());
+    std::copy (d.begin (), d.end (), dmat.begin ());
+    Rcpp::rownames (dmat) = Rcpp::wrap (from);
+    Rcpp::colnames (dmat) = Rcpp::wrap (to);
+    if (!predecessors)
+        return Rcpp::List::create (Rcpp::Named ("d") = dmat);
+
+    Rcpp::IntegerMatrix pmat (from.size (), eng.ids.size ());
+    for (size_t i = 0; i < pred.size (); i++)
+        pmat [i] = (pred [i] == -1) ? NA_INTEGER : (int) pred [i] + 1;
+    return Rcpp::List::create (Rcpp::Named ("d") = dmat,
+            Rcpp::Named ("pred") = pmat,
+            Rcpp::Named ("ids") = Rcpp::wrap (eng.ids));
+}
+
+//' rcpp_engine_map_edges
+//'
+//' Index the expansion of compact edges on to the original graph
+//'
+//' @param engine External pointer from \code{rcpp_engine_create}
+//' @param compact_id \code{edge_id} of each edge of the compact graph, in the
+//' order passed to \code{rcpp_engine_create}
+//' @param map_compact Compact edge IDs of the map between the two graphs
+//' @param map_original Original edge IDs of the map between the two graphs
+//' @param original_id \code{edge_id} of each edge of the original graph
+//'
+//' @noRd
+// [[Rcpp::export]]
+void rcpp_engine_map_edges (SEXP engine, Rcpp::NumericVector compact_id,
+        Rcpp::NumericVector map_compact, Rcpp::NumericVector map_original,
+        Rcpp::NumericVector original_id)
+{
+    engine_from_sexp (engine).map_edges (
+            Rcpp::as <std::vector <vertex_t> > (compact_id),
+            Rcpp::as <std::vector <vertex_t> > (map_compact),
+            Rcpp::as <std::vector <vertex_t> > (map_original),
+            Rcpp::as <std::vector <vertex_t> > (original_id));
+}
 
-    std::vector <vertex_t> path = g.GetShortestPathTo (end_nodei, previous);
-    return Rcpp::wrap (path);
+//' rcpp_engine_expand_path
+//'
+//' Original graph edges traversed by a path through the compact graph
+//'
+//' @param engine External pointer from \code{rcpp_engine_create}, indexed with
+//' \code{rcpp_engine_map_edges}
+//' @param path IDs of the consecutive vertices of the path in the compact graph
+//'
+//' @return \code{Rcpp::IntegerVector} of (1-based) rows of the original graph
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::IntegerVector rcpp_engine_expand_path (SEXP engine,
+        std::vector <std::string> path)
+{
+    router_engine_t &eng = engine_from_sexp (engine);
+    std::vector <vertex_t> vertices (path.size ());
+    for (size_t i = 0; i < path.size (); i++)
+        vertices [i] = eng.lookup (path [i], "path");
+
+    std::vector <size_t> rows = eng.expand_path (vertices);
+    Rcpp::IntegerVector res (rows.size ());
+    for (size_t i = 0; i < rows.size (); i++)
+        res [i] = (int) rows [i] + 1;
+    return res;
+}
+
+//' rcpp_engine_nearest
+//'
+//' Vertices of the compact graph nearest to a set of points
+//'
+//' @param engine External pointer from \code{rcpp_engine_create}
+//' @param lon Longitudes of the points
+//' @param lat Latitudes of the points
+//' @param k Number of nearest vertices to find for each point
+//'
+//' @return \code{Rcpp::List} with the IDs (\code{id}) of the \code{k} nearest
+//' vertices to each point, and their great circle distances in km (\code{d}),
+//' both as (points x k) matrices in column-major order, padded with \code{NA}
+//' where the graph has fewer than \code{k} vertices or a point is not finite
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::List rcpp_engine_nearest (SEXP engine, std::vector <double> lon,
+        std::vector <double> lat, int k = 1)
+{
+    router_engine_t &eng = engine_from_sexp (engine);
+    if (k < 1)
+        throw std::runtime_error ("k must be positive");
+    std::vector <vertex_t> nearest;
+    std::vector <double> d;
+    eng.nearest_vertices (lon, lat, (size_t) k, nearest, d);
+
+    Rcpp::CharacterVector ids (nearest.size ());
+    Rcpp::NumericVector dist (nearest.size ());
+    for (size_t i = 0; i < nearest.size (); i++)
+    {
+        if (nearest [i] == -1)
+        {
+            ids [i] = NA_STRING;
+            dist [i] = NA_REAL;
+        } else
+        {
+            ids [i] = eng.ids [nearest [i]];
+            dist [i] = d [i];
+        }
+    }
+    return Rcpp::List::create (Rcpp::Named ("id") = ids,
+            Rcpp::Named ("d") = dist);
+}
+
+//' rcpp_nearest
+//'
+//' Points nearest to each of a set of query points, from a spatial index which
+//' is built for this call alone
+//'
+//' @param vx Longitudes of the points to search
+//' @param vy Latitudes of the points to search
+//' @param lon Longitudes of the query points
+//' @param lat Latitudes of the query points
+//' @param k Number of nearest points to find for each query point
+//'
+//' @return \code{Rcpp::List} with the (1-based) indices into \code{vx} and
+//' \code{vy} of the \code{k} nearest points to each query point
+//' (\code{index}), and their great circle distances in km (\code{d}), both
+//' as (points x k) matrices in column-major order, padded with \code{NA}
+//' where there are fewer than \code{k} points or a query point is not finite
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::List rcpp_nearest (std::vector <double> vx, std::vector <double> vy,
+        std::vector <double> lon, std::vector <double> lat, int k = 1)
+{
+    if (k < 1)
+        throw std::runtime_error ("k must be positive");
+    if (vx.size () != vy.size () || lon.size () != lat.size ())
+        throw std::runtime_error ("lon and lat differ in length");
+    kdtree_t tree;
+    tree.build (vx, vy);
+    haversine_points_t vp;
+    vp.assign (vx.data (), vy.data (), vx.size ());
+    std::vector <long long> nearest;
+    std::vector <double> d;
+    nearest_points (tree, vp, lon, lat, (size_t) k, nearest, d);
+
+    Rcpp::IntegerVector index (nearest.size ());
+    Rcpp::NumericVector dist (nearest.size ());
+    for (size_t i = 0; i < nearest.size (); i++)
+    {
+        if (nearest [i] == -1)
+        {
+            index [i] = NA_INTEGER;
+            dist [i] = NA_REAL;
+        } else
+        {
+            index [i] = (int) nearest [i] + 1;
+            dist [i] = d [i];
+        }
+    }
+    return Rcpp::List::create (Rcpp::Named ("index") = index,
+            Rcpp::Named ("d") = dist);
 }
@@ -35,51 +35,132 @@
 #include <string>
 #include <list>
 #include <limits> // for numeric_limits
-#include <set>
 #include <utility> // for pair
 #include <algorithm>
 #include <iterator>
+#include <unordered_map>
+#include <exception>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include <RcppArmadillo.h>
 // [[Rcpp::depends(RcppArmadillo)]]
 
-typedef long long vertex_t;
-typedef double weight_t;
+#include "csr-mat.h"
+#include "graph-csr.h"
+#include "sp-search.h"
+#include "haversine.h"
+#include "ch.h"
+#include "kdtree.h"
+#include "rsp.h"
 
-const weight_t max_weight = std::numeric_limits <weight_t>::infinity();
+// How x_vec = N h_vec and v_vec = N (...) are obtained, with N = (I - Q)^-1:
+// SOLVER_INVERSE forms N explicitly (dense only); SOLVER_LU factorises
+// (I - Q) once and back-substitutes; SOLVER_BICGSTAB iterates (sparse only).
+enum solver_t { SOLVER_INVERSE, SOLVER_LU, SOLVER_BICGSTAB };
 
-struct neighbor {
-    vertex_t target;
-    weight_t weight;
-    neighbor (vertex_t arg_target, weight_t arg_weight)
-        : target (arg_target), weight (arg_weight) { }
-};
+const unsigned node_npos = static_cast <unsigned> (-1);
 
-typedef std::map <vertex_t, std::vector <neighbor> > adjacency_list_t;
+// The number of threads available to the next parallel region, and the
+// number of the calling thread within one, in the absence of OpenMP too
+int max_threads ()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads ();
+#else
+    return 1;
+#endif
+}
+
+int thread_num ()
+{
+#ifdef _OPENMP
+    return omp_get_thread_num ();
+#else
+    return 0;
+#endif
+}
 
 class Graphmp
 {
     protected:
         const std::vector <vertex_t> _idfrom, _idto;
         const std::vector <weight_t> _d;
-        const vertex_t _start_node, _end_node;
+        vertex_t _start_node, _end_node; // changed only by set_endpoints
         const double _eta; // The entropy parameter
+        const bool _sparse; // Q and D held as csr_mat_t instead of arma::mat
+        const solver_t _solver;
         unsigned _num_vertices;
 
     public:
-        std::set <vertex_t> all_nodes;
-        adjacency_list_t adjlist; // the graph data
+        // Sorted distinct vertex IDs, and the inverse mapping from ID to
+        // position therein (node_npos for IDs absent from the graph). Matrix
+        // row and column i + 1 both correspond to node_ids [i].
+        std::vector <vertex_t> node_ids;
+        std::vector <unsigned> node_pos;
+        csr_graph_t graph; // the graph data, indexed directly by vertex ID
+        sp_workspace_t workspace; // reused by all shortest path queries
+        csr_graph_t graph_rev; // reversed graph, built on first use
+        sp_workspace_t workspace_rev;
+        // Vertex coordinates for A*, and the minimal ratio of edge weight to
+        // great circle distance, so that heuristic_scale * haversine () is a
+        // lower bound on the weighted distance between any two vertices.
+        // vpoints holds the same coordinates in radians for the heuristic.
+        std::vector <double> vx, vy;
+        haversine_points_t vpoints;
+        double heuristic_scale = 0.0;
         arma::mat d_mat, q_mat, n_mat; // <double>
+        arma::mat lu_l, lu_u, lu_p; // P' L U = (I - Q) for SOLVER_LU
+        std::vector <arma::uword> lu_perm; // (P b) [i] = b [lu_perm [i]]
         arma::vec h_vec, x_vec, v_vec; // also <double>
+        // Sparse mode: d_sp shares the sparsity pattern of q_sp, and iq_sp is
+        // (I - Q) for the initial Q, which replaces the dense n_mat.
+        csr_mat_t d_sp, q_sp, iq_sp;
+        sparse_lu_t iq_lu;
+        // Dense mode: the entries of q_mat which may be non-zero, and the
+        // corresponding entries of d_mat, as CSR matrices over which the
+        // convergence loop runs. Entries of q_mat which are initially zero
+        // remain so.
+        csr_mat_t q_csr, d_csr;
+        // Storage reused by every iteration of calculate_q_mat. The values
+        // of each new Q are written to q_next, and then swapped with those
+        // of q_csr or q_sp.
+        std::vector <double> q_next;
+        arma::vec v_rhs;
+        std::vector <double> solve_work;
+        bicgstab_workspace_t bicgstab_work;
+        // Rows of the start and end nodes for which (I - Q) was last
+        // factorised or inverted. The endpoints only affect row 0 and the
+        // row of the end node of the initial Q, so for others the change to
+        // (I - Q) is - U V', where the k <= 3 columns of U are the unit
+        // vectors of upd_rows, and those of V the changes to these rows.
+        // solve_n then applies the Woodbury identity through upd_nu = N U
+        // and upd_cinv = (I - V' N U)^-1, all held column-major, rather than
+        // refactorising.
+        unsigned base_dstart = 0, base_dend = 0;
+        std::vector <unsigned> upd_rows;
+        std::vector <double> upd_v, upd_nu, upd_cinv, upd_t;
 
         Graphmp (std::vector <vertex_t> idfrom, std::vector <vertex_t> idto,
                 std::vector <weight_t> d, vertex_t start_node,
-                vertex_t end_node, double eta)
+                vertex_t end_node, double eta, bool sparse = false,
+                solver_t solver = SOLVER_LU)
             : _idfrom (idfrom), _idto (idto), _d (d),
-                _start_node (start_node), _end_node (end_node), _eta (eta)
+                _start_node (start_node), _end_node (end_node), _eta (eta),
+                _sparse (sparse), _solver (solver)
         {
-            _num_vertices = fillGraph (); // fills adjlist with (idfrom, idto, d)
-            make_dq_mats ();
+            if (_sparse && _solver == SOLVER_INVERSE)
+                throw std::runtime_error (
+                        "solver 'inverse' requires dense matrices");
+            if (!_sparse && _solver == SOLVER_BICGSTAB)
+                throw std::runtime_error (
+                        "solver 'bicgstab' requires sparse matrices");
+            _num_vertices = fillGraph (); // fills graph with (idfrom, idto, d)
+            if (_sparse)
+                make_dq_sp_mats ();
+            else
+                make_dq_mats ();
             make_n_mat ();
         }
 
@@ -87,7 +168,8 @@ class Graphmp
                 std::vector <weight_t> d, unsigned start_node,
                 unsigned end_node)
             : _idfrom (idfrom), _idto (idto), _d (d),
-                _start_node (start_node), _end_node (end_node), _eta (1)
+                _start_node (start_node), _end_node (end_node), _eta (1),
+                _sparse (false), _solver (SOLVER_LU)
         {
             fillGraph ();
         }
@@ -104,8 +186,11 @@ class Graphmp
         std::vector <vertex_t> return_idto() { return _idto; }
         std::vector <weight_t> return_d() { return _d; }
         double return_eta() { return _eta;  }
+        bool is_sparse() { return _sparse;  }
+        solver_t return_solver() { return _solver;  }
 
         unsigned fillGraph ();
+        unsigned node_index (vertex_t id) const;
         void dumpGraph ();
         void dumpMat (arma::mat mat, std::string mat_name,
                 std::vector <std::string> cnames);
@@ -114,11 +199,31 @@ class Graphmp
                 std::vector <vertex_t> &previous);
         std::vector <vertex_t> GetShortestPathTo (vertex_t vertex, 
                 const std::vector <vertex_t> &previous);
+        void set_coordinates (const std::vector <double> &from_x,
+                const std::vector <double> &from_y,
+                const std::vector <double> &to_x,
+                const std::vector <double> &to_y);
+        std::vector <vertex_t> shortest_path (vertex_t source,
+                vertex_t target, sp_method_t method, size_t &nsettled);
+        void distance_matrix (const std::vector <vertex_t> &sources,
+                const std::vector <vertex_t> &targets,
+                std::vector <weight_t> &d, std::vector <vertex_t> *pred);
 
         void make_dq_mats ();
         void make_n_mat ();
+        void solve_n (const arma::vec &b, arma::vec &x);
+        void solve_n_base (const arma::vec &b, arma::vec &x);
+        void initial_q_row (unsigned row, unsigned dstart, unsigned dend,
+                std::vector <double> &q);
+        void set_endpoints (vertex_t start_node, vertex_t end_node);
+        void make_q_csr ();
+        void make_hxv_rows (const csr_mat_t &q, const csr_mat_t &d);
         void make_hxv_vecs ();
-        void iterate_q_mat ();
+        double iterate_q_mat ();
+        void make_dq_sp_mats ();
+        void make_hxv_sp_vecs ();
+        double iterate_q_sp_mat ();
+        double get_q (vertex_t from, vertex_t to);
         unsigned calculate_q_mat (double tol, unsigned max_iter);
 };
 
@@ -136,31 +241,43 @@ unsigned Graphmp::fillGraph ()
     std::vector <vertex_t> idfrom = return_idfrom ();
     std::vector <vertex_t> idto = return_idto ();
     std::vector <weight_t> d = return_d ();
-    std::vector <neighbor> nblist;
 
+    vertex_t max_id = -1;
     for (unsigned i=0; i<idfrom.size (); i++)
-    {
-        all_nodes.insert (idfrom [i]);
-        if (adjlist.find (idfrom [i]) != adjlist.end ())
+        max_id = std::max (max_id, std::max (idfrom [i], idto [i]));
+    graph.build (idfrom, idto, d, (size_t) (max_id + 1));
+
+    // IDs index the CSR graph directly, so a dense table over [0, max_id]
+    // gives the position of each ID in O(1).
+    const size_t nids = (size_t) (max_id + 1);
+    std::vector <bool> present (nids, false);
+    for (unsigned i=0; i<idfrom.size (); i++)
+        present [idfrom [i]] = present [idto [i]] = true;
+    node_ids.clear ();
+    node_pos.assign (nids, node_npos);
+    for (size_t v=0; v<nids; v++)
+        if (present [v])
         {
-            nblist = adjlist [idfrom [i]];
-            adjlist.erase (idfrom [i]);
+            node_pos [v] = node_ids.size ();
+            node_ids.push_back ((vertex_t) v);
         }
-        nblist.push_back (neighbor (idto [i], d [i]));
-        adjlist.insert (std::make_pair (idfrom [i], nblist));
-        all_nodes.insert (idto [i]);
-        nblist.clear ();
-    }
 
-    return all_nodes.size ();
+    return node_ids.size ();
+}
+
+unsigned Graphmp::node_index (vertex_t id) const
+{
+    if (id < 0 || (size_t) id >= node_pos.size () || node_pos [id] == node_npos)
+        throw std::runtime_error ("vertex ID is not part of the graph");
+    return node_pos [id];
 }
 
 void Graphmp::dumpGraph ()
 {
-    for (auto const &it1 : adjlist)
-        for (auto const &it2 : it1.second)
-            Rcpp::Rcout << "[" << it1.first << "] (" <<
-                it2.target << ", " << it2.weight << ")" << std::endl;
+    for (size_t u=0; u<graph.nvertices; u++)
+        for (size_t k=graph.offsets [u]; k<graph.offsets [u + 1]; k++)
+            Rcpp::Rcout << "[" << u << "] (" << graph.targets [k] << ", " <<
+                graph.weights [k] << ")" << std::endl;
 }
 
 void Graphmp::dumpMat (arma::mat mat, std::string mat_name,
@@ -186,39 +303,19 @@ void Graphmp::Dijkstra (vertex_t source,
         std::vector <weight_t> &min_distance,
         std::vector <vertex_t> &previous)
 {
-    int n = adjlist.size();
-    min_distance.clear();
-    min_distance.resize (n, max_weight);
-    min_distance [source] = 0;
-    previous.clear();
-    previous.resize (n, -1);
-    std::set <std::pair <weight_t, vertex_t> > vertex_queue;
-    vertex_queue.insert (std::make_pair (min_distance [source], source));
-
-    while (!vertex_queue.empty()) 
-    {
-        weight_t dist = vertex_queue.begin()->first;
-        vertex_t u = vertex_queue.begin()->second;
-        vertex_queue.erase (vertex_queue.begin());
-
-        // Visit each edge exiting u
-        const std::vector <neighbor> &neighbors = adjlist [u];
-        for (std::vector <neighbor>::const_iterator neighbor_iter = neighbors.begin();
-                neighbor_iter != neighbors.end(); neighbor_iter++)
-        {
-            vertex_t v = neighbor_iter->target;
-            weight_t weight = neighbor_iter->weight;
-            weight_t distance_through_u = dist + weight;
-            if (distance_through_u < min_distance [v]) {
-                vertex_queue.erase (std::make_pair (min_distance [v], v));
-
-                min_distance [v] = distance_through_u;
-                previous [v] = u;
-                vertex_queue.insert (std::make_pair (min_distance [v], v));
+    if (source < 0 || static_cast <size_t> (source) >= graph.nvertices)
+        throw std::runtime_error ("vertex is not part of the graph");
 
-            }
+    // Settles the whole graph; see shortest_path for single-target queries
+    dijkstra_search (graph, source, -1, workspace);
 
-        }
+    const size_t n = graph.nvertices;
+    min_distance.resize (n);
+    previous.resize (n);
+    for (size_t v = 0; v < n; v++)
+    {
+        min_distance [v] = workspace.distance (v);
+        previous [v] = workspace.previous (v);
     }
 }
 
@@ -240,3 +337,370 @@ std::vector <vertex_t> Graphmp::GetShortestPathTo (vertex_t vertex,
     return path;
 }
 
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                           SHORTEST_PATH                            **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// Point-to-point query which stops as soon as target is settled. nsettled
+// returns the number of vertices settled by the search.
+std::vector <vertex_t> Graphmp::shortest_path (vertex_t source,
+        vertex_t target, sp_method_t method, size_t &nsettled)
+{
+    const vertex_t n = static_cast <vertex_t> (graph.nvertices);
+    if (source < 0 || source >= n || target < 0 || target >= n)
+        throw std::runtime_error ("vertex is not part of the graph");
+
+    if (method == SP_ASTAR)
+    {
+        if (vx.size () != graph.nvertices)
+            throw std::runtime_error ("A* search requires coordinates");
+        const double tx = vpoints.x [target], ty = vpoints.y [target],
+              tcos = vpoints.cos_y [target];
+        auto heuristic = [this, tx, ty, tcos] (vertex_t v) {
+            return heuristic_scale * haversine_rad (vpoints.x [v],
+                    vpoints.y [v], vpoints.cos_y [v], tx, ty, tcos);
+        };
+        nsettled = astar_search (graph, source, target, heuristic,
+                workspace);
+    } else if (method == SP_BIDIRECTIONAL)
+    {
+        if (graph_rev.nvertices != graph.nvertices)
+            graph_rev = graph.reversed ();
+        vertex_t meet;
+        nsettled = bidirectional_search (graph, graph_rev, source, target,
+                workspace, workspace_rev, meet);
+        if (meet == -1)
+            return std::vector <vertex_t> (1, target);
+        std::vector <vertex_t> path = workspace.path_to (meet);
+        for (vertex_t v = workspace_rev.previous (meet); v != -1;
+                v = workspace_rev.previous (v))
+            path.push_back (v);
+        return path;
+    } else
+        nsettled = dijkstra_search (graph, source, target, workspace);
+
+    return workspace.path_to (target);
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                          DISTANCE_MATRIX                           **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// Distances from each source to each target as a column-major (sources x
+// targets) matrix in d, with max_weight where unreachable. Searches from
+// different sources run in parallel, each thread with its own workspace, and
+// stop once all targets are settled. If pred is not NULL it is filled with
+// the predecessor tree of each source as a (sources x vertices) matrix, for
+// which every search settles the whole graph. The workspaces are allocated
+// before the parallel region, and exceptions within it are rethrown after.
+void Graphmp::distance_matrix (const std::vector <vertex_t> &sources,
+        const std::vector <vertex_t> &targets,
+        std::vector <weight_t> &d, std::vector <vertex_t> *pred)
+{
+    const size_t ns = sources.size (), nt = targets.size ();
+    const size_t nv = graph.nvertices;
+    std::vector <bool> is_target (nv, false);
+    size_t ntargets = 0;
+    for (auto t : targets)
+        if (!is_target [t])
+        {
+            is_target [t] = true;
+            ntargets++;
+        }
+    d.assign (ns * nt, max_weight);
+    if (pred)
+        pred->assign (ns * nv, -1);
+
+    const int nthreads = max_threads ();
+    std::vector <sp_workspace_t> workspaces (nthreads);
+    for (auto &ws : workspaces)
+        ws.resize (nv);
+    std::exception_ptr error;
+    #pragma omp parallel num_threads (nthreads)
+    {
+        sp_workspace_t &ws = workspaces [thread_num ()];
+        // signed loop index for OpenMP 2.0
+        #pragma omp for schedule (dynamic)
+        for (long i = 0; i < (long) ns; i++)
+        {
+            try
+            {
+                if (pred)
+                    dijkstra_search (graph, sources [i], -1, ws);
+                else
+                    dijkstra_search_targets (graph, sources [i], is_target,
+                            ntargets, ws);
+                for (size_t j = 0; j < nt; j++)
+                    d [i + j * ns] = ws.distance (targets [j]);
+                if (pred)
+                    for (size_t v = 0; v < nv; v++)
+                        (*pred) [i + v * ns] = ws.previous (v);
+            } catch (...)
+            {
+                #pragma omp critical
+                if (!error)
+                    error = std::current_exception ();
+            }
+        }
+    }
+    if (error)
+        std::rethrow_exception (error);
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                          SET_COORDINATES                           **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// Coordinates are given per edge, as in the compact graph. Edges with zero
+// great circle length (loops, coincident vertices) do not constrain the
+// heuristic scale. The scale is deflated slightly to absorb the rounding of
+// the haversine distances, so the heuristic remains consistent.
+void Graphmp::set_coordinates (const std::vector <double> &from_x,
+        const std::vector <double> &from_y,
+        const std::vector <double> &to_x,
+        const std::vector <double> &to_y)
+{
+    const size_t n = _idfrom.size ();
+    haversine_points_t from, to;
+    from.assign (from_x.data (), from_y.data (), n);
+    to.assign (to_x.data (), to_y.data (), n);
+    std::vector <double> gc (n);
+    haversine_batch (n, from.x.data (), from.y.data (), from.cos_y.data (),
+            to.x.data (), to.y.data (), to.cos_y.data (), gc.data ());
+
+    vx.assign (graph.nvertices, 0.0);
+    vy.assign (graph.nvertices, 0.0);
+    double scale = max_weight;
+    for (size_t i = 0; i < n; i++)
+    {
+        vx [_idfrom [i]] = from_x [i];
+        vy [_idfrom [i]] = from_y [i];
+        vx [_idto [i]] = to_x [i];
+        vy [_idto [i]] = to_y [i];
+        if (gc [i] > 0.0)
+            scale = std::min (scale, _d [i] / gc [i]);
+    }
+    vpoints.assign (vx.data (), vy.data (), vx.size ());
+    heuristic_scale = (scale < max_weight) ? scale * (1.0 - 1.0e-4) : 0.0;
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                           ROUTER_ENGINE                            **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// Shortest path engine prepared once from the compact graph and then held by
+// R as an external pointer, so that queries only pass vertex IDs. String IDs
+// are interned to the contiguous vertex indices of graph, and a contraction
+// hierarchy may be added with build_ch.
+class router_engine_t
+{
+    private:
+        std::vector <vertex_t> intern (const std::vector <std::string> &id)
+        {
+            std::vector <vertex_t> res (id.size ());
+            for (size_t i = 0; i < id.size (); i++)
+            {
+                auto it = index.find (id [i]);
+                if (it == index.end ())
+                {
+                    it = index.emplace (id [i], (vertex_t) ids.size ()).first;
+                    ids.push_back (id [i]);
+                }
+                res [i] = it->second;
+            }
+            return res;
+        }
+
+    public:
+        // Members are initialised in order of declaration, so that from and
+        // to are interned (and numbered) in a fixed order before graph
+        std::vector <std::string> ids;
+        std::unordered_map <std::string, vertex_t> index;
+        std::vector <vertex_t> from, to;
+        Graphmp graph;
+        contraction_hierarchy_t ch;
+        bool has_ch = false;
+        // Expansion of compact edges (rows of netdf) on to rows of the
+        // original graph, set by map_edges. out_rows lists netdf rows grouped
+        // by from vertex, and the original rows of netdf row k are
+        // orig_rows [orig_offsets [k]] to orig_rows [orig_offsets [k + 1] - 1].
+        static const size_t npos = static_cast <size_t> (-1);
+        std::vector <size_t> out_offsets, out_rows, orig_offsets, orig_rows;
+        std::vector <weight_t> row_weight;
+        bool has_edge_map = false;
+        kdtree_t spatial_index; // over graph.vx, graph.vy, built on first use
+        bool has_spatial_index = false;
+
+        router_engine_t (const std::vector <std::string> &from_id,
+                const std::vector <std::string> &to_id,
+                const std::vector <weight_t> &d)
+            : from (intern (from_id)), to (intern (to_id)),
+                graph (from, to, d, 0u, 0u)
+        {
+        }
+
+        vertex_t lookup (const std::string &id, const std::string &what) const
+        {
+            auto it = index.find (id);
+            if (it == index.end ())
+                throw std::runtime_error (what + " is not part of netdf");
+            return it->second;
+        }
+
+        void build_ch ()
+        {
+            ch.build (graph.graph);
+            has_ch = true;
+        }
+
+        std::vector <vertex_t> shortest_path (vertex_t source,
+                vertex_t target, sp_method_t method, size_t &nsettled)
+        {
+            if (method != SP_CH)
+                return graph.shortest_path (source, target, method, nsettled);
+
+            // Building the hierarchy is a preprocessing step in its own
+            // right, so it is never done implicitly by a query
+            if (!has_ch)
+                throw std::runtime_error ("graphs have no contraction "
+                        "hierarchy; see make_contraction_hierarchy");
+            std::vector <vertex_t> path;
+            weight_t distance;
+            nsettled = ch.query (source, target, path, distance);
+            // Unreachable targets give {target}, as for the other methods
+            if (path.empty ())
+                path.push_back (target);
+            return path;
+        }
+
+        // compact_id holds the edge_id of each netdf row, and map_compact and
+        // map_original the two columns of the map between compact and
+        // original edge IDs. Original edges are only mapped when their ID is
+        // unique within original_id.
+        void map_edges (const std::vector <vertex_t> &compact_id,
+                const std::vector <vertex_t> &map_compact,
+                const std::vector <vertex_t> &map_original,
+                const std::vector <vertex_t> &original_id)
+        {
+            const size_t nrows = from.size ();
+            if (compact_id.size () != nrows)
+                throw std::runtime_error (
+                        "compact edge IDs do not match netdf");
+            if (map_compact.size () != map_original.size ())
+                throw std::runtime_error ("map columns differ in length");
+
+            out_offsets.assign (ids.size () + 1, 0);
+            for (size_t i = 0; i < nrows; i++)
+                out_offsets [from [i] + 1]++;
+            for (size_t v = 0; v < ids.size (); v++)
+                out_offsets [v + 1] += out_offsets [v];
+            out_rows.resize (nrows);
+            std::vector <size_t> pos (out_offsets.begin (),
+                    out_offsets.end () - 1);
+            for (size_t i = 0; i < nrows; i++)
+                out_rows [pos [from [i]]++] = i;
+            row_weight = graph.return_d ();
+
+            std::unordered_map <vertex_t, size_t> compact_row, original_row;
+            compact_row.reserve (nrows);
+            for (size_t i = 0; i < nrows; i++)
+                compact_row.emplace (compact_id [i], i);
+            original_row.reserve (original_id.size ());
+            for (size_t i = 0; i < original_id.size (); i++)
+            {
+                auto it = original_row.emplace (original_id [i], i);
+                if (!it.second)
+                    it.first->second = npos;
+            }
+
+            // Counting sort of the map by compact row, retaining map order
+            std::vector <size_t> map_row (map_compact.size (), npos),
+                map_orig (map_compact.size ());
+            orig_offsets.assign (nrows + 1, 0);
+            for (size_t j = 0; j < map_compact.size (); j++)
+            {
+                auto c = compact_row.find (map_compact [j]);
+                auto o = original_row.find (map_original [j]);
+                if (c == compact_row.end () || o == original_row.end () ||
+                        o->second == npos)
+                    continue;
+                map_row [j] = c->second;
+                map_orig [j] = o->second;
+                orig_offsets [c->second + 1]++;
+            }
+            for (size_t k = 0; k < nrows; k++)
+                orig_offsets [k + 1] += orig_offsets [k];
+            orig_rows.resize (orig_offsets [nrows]);
+            pos.assign (orig_offsets.begin (), orig_offsets.end () - 1);
+            for (size_t j = 0; j < map_row.size (); j++)
+                if (map_row [j] != npos)
+                    orig_rows [pos [map_row [j]]++] = map_orig [j];
+
+            has_edge_map = true;
+        }
+
+        // Rows of the original graph traversed by a path of vertices, taking
+        // the lightest of any parallel compact edges, in O(output + degree).
+        std::vector <size_t> expand_path (const std::vector <vertex_t> &path)
+            const
+        {
+            if (!has_edge_map)
+                throw std::runtime_error ("router engine has no edge map");
+            std::vector <size_t> res;
+            for (size_t i = 1; i < path.size (); i++)
+            {
+                const vertex_t u = path [i - 1];
+                size_t best = npos;
+                for (size_t k = out_offsets [u]; k < out_offsets [u + 1]; k++)
+                {
+                    const size_t r = out_rows [k];
+                    if (to [r] == path [i] && (best == npos ||
+                                row_weight [r] < row_weight [best]))
+                        best = r;
+                }
+                if (best != npos)
+                    res.insert (res.end (),
+                            orig_rows.begin () + orig_offsets [best],
+                            orig_rows.begin () + orig_offsets [best + 1]);
+            }
+            return res;
+        }
+
+        // The k vertices nearest to each of n points by great circle
+        // distance, in order of increasing distance. Vertex j of point i is
+        // nearest [i + j * n] at d [i + j * n] km, or -1 if the graph has
+        // fewer than k vertices or the point is not finite.
+        void nearest_vertices (const std::vector <double> &lon,
+                const std::vector <double> &lat, size_t k,
+                std::vector <vertex_t> &nearest, std::vector <double> &d)
+        {
+            if (graph.vx.empty ())
+                throw std::runtime_error (
+                        "nearest vertex search requires coordinates");
+            if (lon.size () != lat.size ())
+                throw std::runtime_error ("lon and lat differ in length");
+            if (!has_spatial_index)
+            {
+                spatial_index.build (graph.vx, graph.vy);
+                has_spatial_index = true;
+            }
+            nearest_points (spatial_index, graph.vpoints, lon, lat, k,
+                    nearest, d);
+        }
+};
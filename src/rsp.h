@@ -0,0 +1,286 @@
+/***************************************************************************
+ *  Project:    osmprob
+ *  File:       rsp.h
+ *  Language:   C++
+ *
+ *  Description:    Randomised shortest paths between a start and an end
+ *                  node, as formulated in the gdistance package. W holds the
+ *                  transition probabilities of a random walk, in proportion
+ *                  to the inverse weighted distance of each edge, damped by
+ *                  exp (-eta * weighted distance), with the end node made
+ *                  absorbing. Then z1 = (I - W)'^-1 e_start and zn = (I -
+ *                  W)^-1 e_end give the expected number of passages of each
+ *                  edge as N_ij = z1_i W_ij zn_j / zn_start. Both solves use
+ *                  a single sparse factorisation of (I - W), and N is only
+ *                  evaluated on existing edges. The flows of any number of
+ *                  routes to one end node are summed through that same
+ *                  factorisation. Factorisations for further values of eta
+ *                  or end nodes reuse the symbolic analysis of the first.
+ *
+ *  Compiler Options:   -std=c++11
+ ***************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <stdexcept>
+#include <algorithm>
+
+#include "csr-mat.h"
+
+class rsp_router_t
+{
+    public:
+        static const size_t npos = static_cast <size_t> (-1);
+
+        // Distinct edges as the CSR pattern of w, whose values are W for the
+        // current eta. Repeated edges share one entry, holding the distances
+        // of their last occurrence, and entry [e] is the entry of input edge
+        // e. cost, dist and prior are the weighted and unweighted distances
+        // and the undamped transition probabilities of each entry.
+        csr_mat_t w;
+        std::vector <double> cost, dist, prior;
+        std::vector <size_t> entry;
+        // (I - W) with the row of the absorbing end_node set to that of I,
+        // and its factorisation
+        csr_mat_t iw;
+        sparse_lu_t lu;
+        size_t end_node = npos;
+        // Results of the last route, on the entries of w
+        std::vector <double> z1, zn, dens, prob;
+        double distance = 0.0;
+        std::vector <double> rhs, work, nsum_out, nsum_in, y;
+
+        rsp_router_t (const std::vector <size_t> &from,
+                const std::vector <size_t> &to,
+                const std::vector <double> &d,
+                const std::vector <double> &d_weighted, size_t nvertices)
+        {
+            const size_t nedges = from.size ();
+            w.nrows = nvertices;
+
+            // Counting sort of edges by from vertex, retaining input order
+            std::vector <size_t> offsets (nvertices + 1, 0), order (nedges);
+            for (size_t e = 0; e < nedges; e++)
+                offsets [from [e] + 1]++;
+            for (size_t i = 0; i < nvertices; i++)
+                offsets [i + 1] += offsets [i];
+            std::vector <size_t> pos (offsets.begin (), offsets.end () - 1);
+            for (size_t e = 0; e < nedges; e++)
+                order [pos [from [e]]++] = e;
+
+            // last [j] is the latest entry for column j, which belongs to the
+            // current row only if it is not before the row's first entry
+            std::vector <size_t> last (nvertices, npos);
+            entry.resize (nedges);
+            w.row_ptr.assign (nvertices + 1, 0);
+            for (size_t i = 0; i < nvertices; i++)
+            {
+                const size_t k0 = w.col.size ();
+                for (size_t k = offsets [i]; k < offsets [i + 1]; k++)
+                {
+                    const size_t e = order [k], j = to [e];
+                    if (last [j] == npos || last [j] < k0)
+                    {
+                        last [j] = w.col.size ();
+                        w.col.push_back (j);
+                        cost.push_back (d_weighted [e]);
+                        dist.push_back (d [e]);
+                    } else
+                    {
+                        cost [last [j]] = d_weighted [e];
+                        dist [last [j]] = d [e];
+                    }
+                    entry [e] = last [j];
+                }
+                w.row_ptr [i + 1] = w.col.size ();
+            }
+            w.val.assign (w.col.size (), 0.0);
+
+            // Rows of prior are normalised wherever they have a positive sum
+            prior.resize (w.col.size ());
+            for (size_t i = 0; i < nvertices; i++)
+            {
+                double rsum = 0.0;
+                for (size_t k = w.row_ptr [i]; k < w.row_ptr [i + 1]; k++)
+                {
+                    prior [k] = 1.0 / cost [k];
+                    rsum += prior [k];
+                }
+                const double scale = (rsum > 0.0) ? 1.0 / rsum : rsum;
+                for (size_t k = w.row_ptr [i]; k < w.row_ptr [i + 1]; k++)
+                    prior [k] *= scale;
+            }
+        }
+
+        size_t nvertices () const { return w.nrows; }
+
+        // Non-finite weights, as from zero distances, are taken as zero
+        void set_eta (double eta)
+        {
+            for (size_t k = 0; k < w.val.size (); k++)
+            {
+                const double x = std::exp (-eta * cost [k]) * prior [k];
+                w.val [k] = std::isfinite (x) ? x : 0.0;
+            }
+            end_node = npos;
+        }
+
+        // The pattern of (I - W) is the same for every eta and end node, as
+        // the row of end_node retains its entries as zeros, so it is only
+        // analysed once, and copies of the router share that analysis
+        void analyse ()
+        {
+            iw = identity_minus (w);
+            lu.analyse (iw);
+        }
+
+        // Values of (I - W) are refilled in place, with the diagonal first
+        // in each row as in identity_minus
+        void factorise (size_t end)
+        {
+            if (iw.nrows == 0)
+                analyse ();
+            for (size_t i = 0; i < w.nrows; i++)
+            {
+                const size_t diag = iw.row_ptr [i];
+                size_t kw = diag + 1;
+                iw.val [diag] = 1.0;
+                for (size_t k = w.row_ptr [i]; k < w.row_ptr [i + 1]; k++)
+                    if (w.col [k] == i)
+                        iw.val [diag] -= w.val [k];
+                    else
+                        iw.val [kw++] = -w.val [k];
+            }
+            for (size_t k = iw.row_ptr [end]; k < iw.row_ptr [end + 1]; k++)
+                iw.val [k] = (k == iw.row_ptr [end]) ? 1.0 : 0.0;
+            // The factors are only valid for end once refactorise succeeds
+            end_node = npos;
+            try
+            {
+                lu.refactorise (iw);
+            } catch (singular_matrix_error &)
+            {
+                throw singular_matrix_error ("(I - W) is singular");
+            }
+            end_node = end;
+        }
+
+        // Densities, probabilities and expected distance of the route from
+        // start to end, which are all zero and false is returned if end can
+        // not be reached from start. The factorisation is reused as long as
+        // end and eta remain the same.
+        bool route (size_t start, size_t end)
+        {
+            const size_t n = nvertices ();
+            if (start >= n || end >= n)
+                throw std::runtime_error ("node is not part of the graph");
+            if (end != end_node)
+                factorise (end);
+
+            rhs.assign (n, 0.0);
+            z1.resize (n);
+            zn.resize (n);
+            rhs [start] = 1.0;
+            lu.solve_transposed (rhs.data (), z1.data (), work);
+            rhs [start] = 0.0;
+            rhs [end] = 1.0;
+            lu.solve (rhs.data (), zn.data (), work);
+
+            dens.assign (w.val.size (), 0.0);
+            prob.assign (w.val.size (), 0.0);
+            distance = 0.0;
+            const double z1n = zn [start];
+            if (!(z1n > 1.0e-300))
+                return false;
+
+            // The row of end is zero in W, so also in N
+            nsum_out.assign (n, 0.0);
+            nsum_in.assign (n, 0.0);
+            for (size_t i = 0; i < n; i++)
+            {
+                if (i == end)
+                    continue;
+                for (size_t k = w.row_ptr [i]; k < w.row_ptr [i + 1]; k++)
+                {
+                    const size_t j = w.col [k];
+                    dens [k] = z1 [i] * w.val [k] * zn [j] / z1n;
+                    nsum_out [i] += dens [k];
+                    nsum_in [j] += dens [k];
+                    distance += dist [k] * dens [k];
+                }
+            }
+            // Probabilities are densities relative to the larger of the
+            // total flows out of and into their from vertex
+            for (size_t i = 0; i < n; i++)
+            {
+                const double nmax = std::max (nsum_out [i], nsum_in [i]);
+                if (nmax > 0.0)
+                    for (size_t k = w.row_ptr [i]; k < w.row_ptr [i + 1]; k++)
+                        prob [k] = dens [k] / nmax;
+            }
+
+            return true;
+        }
+
+        // Routes from each of norigins origins to end, of which origin o
+        // adds weights [o] times its densities to flow, on the entries of w,
+        // and has expected distance dist [o], or NaN if end can not be
+        // reached from it. Densities are linear in z1 = (I - W)'^-1 e_start,
+        // so those of all origins are summed through a single transposed
+        // solve, and the expected distances of all origins follow from a
+        // single further solve.
+        void add_flows (size_t end, const size_t *origins,
+                const double *weights, size_t norigins,
+                std::vector <double> &flow, double *dist_out)
+        {
+            const size_t n = nvertices ();
+            if (end >= n)
+                throw std::runtime_error ("node is not part of the graph");
+            if (end != end_node)
+                factorise (end);
+
+            rhs.assign (n, 0.0);
+            zn.resize (n);
+            rhs [end] = 1.0;
+            lu.solve (rhs.data (), zn.data (), work);
+
+            // dist [o] = z1' (W * D) zn / zn [o] = ((I - W)^-1 g) [o] / zn [o]
+            for (size_t i = 0; i < n; i++)
+            {
+                rhs [i] = 0.0;
+                if (i == end)
+                    continue;
+                for (size_t k = w.row_ptr [i]; k < w.row_ptr [i + 1]; k++)
+                    rhs [i] += w.val [k] * dist [k] * zn [w.col [k]];
+            }
+            y.resize (n);
+            lu.solve (rhs.data (), y.data (), work);
+
+            rhs.assign (n, 0.0);
+            for (size_t o = 0; o < norigins; o++)
+            {
+                const size_t s = origins [o];
+                if (s >= n)
+                    throw std::runtime_error ("node is not part of the graph");
+                if (zn [s] > 1.0e-300)
+                {
+                    rhs [s] += weights [o] / zn [s];
+                    dist_out [o] = y [s] / zn [s];
+                } else
+                    dist_out [o] = std::nan ("");
+            }
+            z1.resize (n);
+            lu.solve_transposed (rhs.data (), z1.data (), work);
+
+            flow.resize (w.val.size (), 0.0);
+            for (size_t i = 0; i < n; i++)
+            {
+                if (i == end || z1 [i] == 0.0)
+                    continue;
+                for (size_t k = w.row_ptr [i]; k < w.row_ptr [i + 1]; k++)
+                    flow [k] += z1 [i] * w.val [k] * zn [w.col [k]];
+            }
+        }
+};
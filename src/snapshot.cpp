@@ -0,0 +1,175 @@
+/***************************************************************************
+ *  Project:    osmprob
+ *  File:       snapshot.cpp
+ *  Language:   C++
+ *
+ *  Description:    Save the data.frames of a set of graphs as a binary
+ *                  snapshot (snapshot.h), and restore them from one.
+ *
+ *  Compiler Options:   -std=c++11
+ ***************************************************************************/
+
+#include <string>
+#include <vector>
+#include <list>
+#include <cstring>
+
+#include <Rcpp.h>
+
+#include "snapshot.h"
+
+//' rcpp_write_snapshot
+//'
+//' Write all data.frames of a list to a binary snapshot
+//'
+//' @param graphs \code{list} of \code{data.frame} objects with columns of
+//' type \code{numeric}, \code{integer}, \code{logical} or \code{character}
+//' @param file Name of the snapshot file
+//'
+//' @noRd
+// [[Rcpp::export]]
+void rcpp_write_snapshot (Rcpp::List graphs, std::string file)
+{
+    snapshot_writer_t writer;
+    // String columns are written as indices, held here until written
+    std::list <std::vector <uint32_t> > string_cols;
+
+    Rcpp::CharacterVector tnames = graphs.attr ("names");
+    for (int t = 0; t < graphs.size (); t++)
+    {
+        Rcpp::List df = graphs [t];
+        Rcpp::CharacterVector cnames = df.attr ("names");
+        snapshot_table_t table;
+        table.name = Rf_translateCharUTF8 (STRING_ELT (tnames, t));
+        table.nrows = 0;
+        if (df.size () > 0)
+        {
+            SEXP x0 = df [0];
+            table.nrows = Rf_xlength (x0);
+        }
+        for (int c = 0; c < df.size (); c++)
+        {
+            SEXP x = df [c];
+            snapshot_column_t col;
+            col.name = Rf_translateCharUTF8 (STRING_ELT (cnames, c));
+            if ((size_t) Rf_xlength (x) != table.nrows)
+                throw std::runtime_error ("columns of " + table.name +
+                        " differ in length");
+            switch (TYPEOF (x))
+            {
+                case REALSXP:
+                    col.type = SNAPSHOT_REAL;
+                    col.data = REAL (x);
+                    break;
+                case INTSXP:
+                    col.type = SNAPSHOT_INTEGER;
+                    col.data = INTEGER (x);
+                    break;
+                case LGLSXP:
+                    col.type = SNAPSHOT_LOGICAL;
+                    col.data = LOGICAL (x);
+                    break;
+                case STRSXP:
+                {
+                    // Stored in UTF-8, whatever their encoding in R, as
+                    // rcpp_read_snapshot marks all strings as such
+                    std::vector <uint32_t> idx (table.nrows);
+                    for (size_t i = 0; i < table.nrows; i++)
+                    {
+                        SEXP s = STRING_ELT (x, i);
+                        idx [i] = (s == NA_STRING) ? snapshot_na_string :
+                            writer.intern (Rf_translateCharUTF8 (s));
+                    }
+                    string_cols.push_back (std::move (idx));
+                    col.type = SNAPSHOT_STRING;
+                    col.data = string_cols.back ().data ();
+                    break;
+                }
+                default:
+                    throw std::runtime_error ("column " + col.name + " of " +
+                            table.name + " can not be saved");
+            }
+            table.columns.push_back (col);
+        }
+        writer.tables.push_back (table);
+    }
+
+    writer.write (file);
+}
+
+//' rcpp_read_snapshot
+//'
+//' Read all data.frames from a binary snapshot
+//'
+//' @param file Name of the snapshot file
+//'
+//' @return \code{list} of \code{data.frame} objects as passed to
+//' \code{rcpp_write_snapshot}
+//'
+//' @noRd
+// [[Rcpp::export]]
+Rcpp::List rcpp_read_snapshot (std::string file)
+{
+    snapshot_reader_t snapshot (file);
+
+    // Each distinct string is made an R string only once
+    Rcpp::CharacterVector strings (snapshot.nstrings);
+    for (uint64_t i = 0; i < snapshot.nstrings; i++)
+        SET_STRING_ELT (strings, i, Rf_mkCharLenCE (snapshot.string_begin (i),
+                    (int) snapshot.string_size (i), CE_UTF8));
+
+    Rcpp::List res (snapshot.tables.size ());
+    Rcpp::CharacterVector tnames (snapshot.tables.size ());
+    for (size_t t = 0; t < snapshot.tables.size (); t++)
+    {
+        const snapshot_table_t &table = snapshot.tables [t];
+        const size_t n = table.nrows;
+        Rcpp::List df (table.columns.size ());
+        Rcpp::CharacterVector cnames (table.columns.size ());
+        for (size_t c = 0; c < table.columns.size (); c++)
+        {
+            const snapshot_column_t &col = table.columns [c];
+            cnames [c] = col.name;
+            if (col.type == SNAPSHOT_REAL)
+            {
+                Rcpp::NumericVector x (n);
+                if (n > 0)
+                    memcpy (REAL (x), col.data, n * sizeof (double));
+                df [c] = x;
+            } else if (col.type == SNAPSHOT_INTEGER)
+            {
+                Rcpp::IntegerVector x (n);
+                if (n > 0)
+                    memcpy (INTEGER (x), col.data, n * sizeof (int));
+                df [c] = x;
+            } else if (col.type == SNAPSHOT_LOGICAL)
+            {
+                Rcpp::LogicalVector x (n);
+                if (n > 0)
+                    memcpy (LOGICAL (x), col.data, n * sizeof (int));
+                df [c] = x;
+            } else
+            {
+                const uint32_t *idx = static_cast <const uint32_t *> (col.data);
+                Rcpp::CharacterVector x (n);
+                for (size_t i = 0; i < n; i++)
+                    SET_STRING_ELT (x, i, idx [i] == snapshot_na_string ?
+                            NA_STRING : STRING_ELT (strings, idx [i]));
+                df [c] = x;
+            }
+        }
+        df.attr ("names") = cnames;
+        // Compact form of automatic row names, as used by R itself
+        if (n > 0)
+            df.attr ("row.names") = Rcpp::IntegerVector::create (NA_INTEGER,
+                    -(int) n);
+        else
+            df.attr ("row.names") = Rcpp::IntegerVector (0);
+        df.attr ("class") = "data.frame";
+        res [t] = df;
+        tnames [t] = table.name;
+    }
+    res.attr ("names") = tnames;
+
+    return res;
+}
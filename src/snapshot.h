@@ -0,0 +1,316 @@
+/***************************************************************************
+ *  Project:    osmprob
+ *  File:       snapshot.h
+ *  Language:   C++
+ *
+ *  Description:    Versioned binary snapshots of a set of tables, such as
+ *                  the compact graph, the original graph and the map between
+ *                  them. Columns are stored contiguously, and all strings
+ *                  once in a shared table referenced by index, so that a
+ *                  snapshot is read through a read-only memory mapping
+ *                  without any parsing. Numeric columns are copied into R
+ *                  vectors as single blocks, and the mapping is released
+ *                  once the tables are read, so that each process holds its
+ *                  own copy of the tables.
+ *
+ *                  Layout, in native byte order with every field aligned to 8
+ *                  bytes (u64 = uint64_t):
+ *                      char magic [8] ("OSMPROB\0")
+ *                      uint32_t version, uint32_t byte order mark
+ *                      u64 file size, u64 nstrings, u64 ntables
+ *                      u64 string offsets [nstrings + 1], then string bytes
+ *                      each table: u64 name, u64 nrows, u64 ncols, and then
+ *                          each column: u64 name, u64 type, and nrows values
+ *                          of 8 (REAL) or 4 (INTEGER, LOGICAL, STRING) bytes.
+ *                  Names are indices into the string table, as are the values
+ *                  of STRING columns, where snapshot_na_string marks NA.
+ *                  All strings are encoded in UTF-8.
+ *
+ *  Compiler Options:   -std=c++11
+ ***************************************************************************/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <fstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+
+#include "mapped-file.h"
+
+const char snapshot_magic [8] = {'O', 'S', 'M', 'P', 'R', 'O', 'B', '\0'};
+const uint32_t snapshot_version = 1;
+const uint32_t snapshot_byte_order = 0x01020304;
+const uint32_t snapshot_na_string = static_cast <uint32_t> (-1);
+
+enum snapshot_type_t
+{
+    SNAPSHOT_REAL = 1, // double
+    SNAPSHOT_INTEGER = 2, // int32_t
+    SNAPSHOT_LOGICAL = 3, // int32_t
+    SNAPSHOT_STRING = 4 // uint32_t index into the string table
+};
+
+inline size_t snapshot_value_size (uint64_t type)
+{
+    return type == SNAPSHOT_REAL ? 8 : 4;
+}
+
+// Data of a column are held elsewhere: by the caller when writing, and in the
+// mapped file when reading
+struct snapshot_column_t
+{
+    std::string name;
+    snapshot_type_t type;
+    const void *data;
+};
+
+struct snapshot_table_t
+{
+    std::string name;
+    size_t nrows;
+    std::vector <snapshot_column_t> columns;
+};
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                          SNAPSHOT_WRITER                           **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+class snapshot_writer_t
+{
+    private:
+        std::vector <std::string> strings;
+        std::unordered_map <std::string, uint32_t> string_index;
+
+        static void write_u64 (std::ofstream &out, uint64_t x)
+        {
+            out.write (reinterpret_cast <const char *> (&x), sizeof (x));
+        }
+        static void pad (std::ofstream &out, size_t nbytes)
+        {
+            static const char zeros [8] = {0};
+            if (nbytes % 8 != 0)
+                out.write (zeros, 8 - nbytes % 8);
+        }
+        static size_t padded (size_t nbytes) { return (nbytes + 7) / 8 * 8; }
+
+    public:
+        std::vector <snapshot_table_t> tables;
+
+        uint32_t intern (const std::string &s)
+        {
+            auto it = string_index.find (s);
+            if (it != string_index.end ())
+                return it->second;
+            if (strings.size () >= snapshot_na_string)
+                throw std::runtime_error ("too many strings for a snapshot");
+            string_index.emplace (s, (uint32_t) strings.size ());
+            strings.push_back (s);
+            return (uint32_t) strings.size () - 1;
+        }
+
+        // Written to a temporary file which then replaces file, so that
+        // readers never map a partially written snapshot
+        void write (const std::string &file)
+        {
+            for (auto &t: tables)
+            {
+                intern (t.name);
+                for (auto &c: t.columns)
+                    intern (c.name);
+            }
+
+            uint64_t size = 40 + 8 * (strings.size () + 1);
+            uint64_t nchars = 0;
+            for (auto &s: strings)
+                nchars += s.size ();
+            size += padded (nchars);
+            for (auto &t: tables)
+            {
+                size += 24;
+                for (auto &c: t.columns)
+                    size += 16 + padded (t.nrows *
+                            snapshot_value_size (c.type));
+            }
+
+            const std::string tmp = file + ".tmp";
+            std::ofstream out (tmp.c_str (), std::ios::binary);
+            if (!out)
+                throw std::runtime_error ("unable to open file " + tmp);
+            out.write (snapshot_magic, 8);
+            out.write (reinterpret_cast <const char *> (&snapshot_version),
+                    4);
+            out.write (reinterpret_cast <const char *> (&snapshot_byte_order),
+                    4);
+            write_u64 (out, size);
+            write_u64 (out, strings.size ());
+            write_u64 (out, tables.size ());
+            uint64_t offset = 0;
+            write_u64 (out, offset);
+            for (auto &s: strings)
+                write_u64 (out, offset += s.size ());
+            for (auto &s: strings)
+                out.write (s.data (), s.size ());
+            pad (out, nchars);
+
+            for (auto &t: tables)
+            {
+                write_u64 (out, string_index.at (t.name));
+                write_u64 (out, t.nrows);
+                write_u64 (out, t.columns.size ());
+                for (auto &c: t.columns)
+                {
+                    write_u64 (out, string_index.at (c.name));
+                    write_u64 (out, c.type);
+                    const size_t nbytes = t.nrows *
+                        snapshot_value_size (c.type);
+                    out.write (static_cast <const char *> (c.data), nbytes);
+                    pad (out, nbytes);
+                }
+            }
+            out.close ();
+            if (!out)
+            {
+                std::remove (tmp.c_str ());
+                throw std::runtime_error ("unable to write file " + tmp);
+            }
+#ifdef _WIN32
+            // rename () does not replace existing files on Windows
+            std::remove (file.c_str ());
+#endif
+            if (std::rename (tmp.c_str (), file.c_str ()) != 0)
+                throw std::runtime_error ("unable to write file " + file);
+        }
+};
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                          SNAPSHOT_READER                           **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// Validates the whole layout on opening; column data then point directly
+// into the mapping, and remain valid for the lifetime of the reader
+class snapshot_reader_t
+{
+    private:
+        mapped_file_t file;
+        const uint64_t *string_offsets = nullptr;
+        const char *string_data = nullptr;
+        size_t pos = 0;
+
+        // Next nbytes of the file, advancing past their padding
+        const char *take (size_t nbytes)
+        {
+            if (nbytes > file.size () - pos ||
+                    (nbytes + 7) / 8 * 8 > file.size () - pos)
+                throw std::runtime_error ("snapshot file is truncated");
+            const char *p = file.data () + pos;
+            pos += (nbytes + 7) / 8 * 8;
+            return p;
+        }
+        uint64_t take_u64 ()
+        {
+            uint64_t x;
+            memcpy (&x, take (8), 8);
+            return x;
+        }
+        std::string name (uint64_t i) const
+        {
+            if (i >= nstrings)
+                throw std::runtime_error ("snapshot file is corrupt");
+            return string (i);
+        }
+
+    public:
+        uint64_t nstrings = 0;
+        std::vector <snapshot_table_t> tables;
+
+        explicit snapshot_reader_t (const std::string &path) : file (path)
+        {
+            if (file.size () < 40 ||
+                    memcmp (file.data (), snapshot_magic, 8) != 0)
+                throw std::runtime_error (path + " is not a graph snapshot");
+            uint32_t version, byte_order;
+            memcpy (&version, file.data () + 8, 4);
+            memcpy (&byte_order, file.data () + 12, 4);
+            if (byte_order != snapshot_byte_order)
+                throw std::runtime_error (
+                        "snapshot was written with a different byte order");
+            if (version != snapshot_version)
+                throw std::runtime_error ("snapshot has version " +
+                        std::to_string (version) + ", but only version " +
+                        std::to_string (snapshot_version) + " can be read");
+            pos = 16;
+            if (take_u64 () != file.size ())
+                throw std::runtime_error ("snapshot file is truncated");
+            nstrings = take_u64 ();
+            const uint64_t ntables = take_u64 ();
+
+            if (nstrings >= (file.size () - pos) / 8)
+                throw std::runtime_error ("snapshot file is corrupt");
+            string_offsets = reinterpret_cast <const uint64_t *> (
+                    take (8 * (nstrings + 1)));
+            for (uint64_t i = 0; i < nstrings; i++)
+                if (string_offsets [i] > string_offsets [i + 1])
+                    throw std::runtime_error ("snapshot file is corrupt");
+            string_data = take (string_offsets [nstrings]);
+
+            for (uint64_t t = 0; t < ntables; t++)
+            {
+                snapshot_table_t table;
+                table.name = name (take_u64 ());
+                table.nrows = take_u64 ();
+                const uint64_t ncols = take_u64 ();
+                for (uint64_t c = 0; c < ncols; c++)
+                {
+                    snapshot_column_t col;
+                    col.name = name (take_u64 ());
+                    const uint64_t type = take_u64 ();
+                    if (type < SNAPSHOT_REAL || type > SNAPSHOT_STRING)
+                        throw std::runtime_error ("snapshot file is corrupt");
+                    col.type = static_cast <snapshot_type_t> (type);
+                    const size_t vsize = snapshot_value_size (type);
+                    if (table.nrows > (file.size () - pos) / vsize)
+                        throw std::runtime_error (
+                                "snapshot file is truncated");
+                    col.data = take (table.nrows * vsize);
+                    if (col.type == SNAPSHOT_STRING)
+                    {
+                        const uint32_t *s =
+                            static_cast <const uint32_t *> (col.data);
+                        for (size_t i = 0; i < table.nrows; i++)
+                            if (s [i] >= nstrings && s [i] !=
+                                    snapshot_na_string)
+                                throw std::runtime_error (
+                                        "snapshot file is corrupt");
+                    }
+                    table.columns.push_back (col);
+                }
+                tables.push_back (table);
+            }
+        }
+
+        const char *string_begin (uint64_t i) const
+        {
+            return string_data + string_offsets [i];
+        }
+        size_t string_size (uint64_t i) const
+        {
+            return string_offsets [i + 1] - string_offsets [i];
+        }
+        std::string string (uint64_t i) const
+        {
+            return std::string (string_begin (i), string_size (i));
+        }
+};
@@ -0,0 +1,400 @@
+/***************************************************************************
+ *  Project:    osmprob
+ *  File:       sp-search.h
+ *  Language:   C++
+ *
+ *  Description:    Shortest path searches (Dijkstra, A*, bidirectional
+ *                  Dijkstra) over csr_graph_t, using an indexed 4-ary heap
+ *                  and a reusable workspace whose arrays are reset lazily
+ *                  through per-query timestamps.
+ *
+ *  Compiler Options:   -std=c++11
+ ***************************************************************************/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "graph-csr.h"
+
+// SP_CH queries a contraction hierarchy (ch.h) and is handled by its owner
+enum sp_method_t { SP_DIJKSTRA, SP_ASTAR, SP_BIDIRECTIONAL, SP_CH };
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                               DHEAP                                **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// Indexed 4-ary min-heap of vertices with decrease-key. pos [v] holds the
+// heap position of v, or heap_npos when v is not in the heap.
+const size_t heap_npos = static_cast <size_t> (-1);
+
+class dheap_t
+{
+    private:
+        static const size_t arity = 4;
+        std::vector <vertex_t> heap;
+        std::vector <weight_t> key;
+        std::vector <size_t> pos;
+
+        void sift_up (size_t i)
+        {
+            const vertex_t v = heap [i];
+            const weight_t k = key [i];
+            while (i > 0)
+            {
+                const size_t parent = (i - 1) / arity;
+                if (key [parent] <= k)
+                    break;
+                heap [i] = heap [parent];
+                key [i] = key [parent];
+                pos [heap [i]] = i;
+                i = parent;
+            }
+            heap [i] = v;
+            key [i] = k;
+            pos [v] = i;
+        }
+
+        void sift_down (size_t i)
+        {
+            const vertex_t v = heap [i];
+            const weight_t k = key [i];
+            const size_t n = heap.size ();
+            while (true)
+            {
+                const size_t c0 = i * arity + 1;
+                if (c0 >= n)
+                    break;
+                const size_t c1 = std::min (c0 + arity, n);
+                size_t best = c0;
+                for (size_t c = c0 + 1; c < c1; c++)
+                    if (key [c] < key [best])
+                        best = c;
+                if (key [best] >= k)
+                    break;
+                heap [i] = heap [best];
+                key [i] = key [best];
+                pos [heap [i]] = i;
+                i = best;
+            }
+            heap [i] = v;
+            key [i] = k;
+            pos [v] = i;
+        }
+
+    public:
+        void resize (size_t n)
+        {
+            pos.assign (n, heap_npos);
+            heap.clear ();
+            key.clear ();
+        }
+        bool empty () const { return heap.empty (); }
+        size_t size () const { return heap.size (); }
+        bool contains (vertex_t v) const { return pos [v] != heap_npos; }
+        vertex_t top () const { return heap [0]; }
+        weight_t top_key () const { return key [0]; }
+
+        // Insert v, or lower its key if already present
+        void push (vertex_t v, weight_t k)
+        {
+            if (pos [v] == heap_npos)
+            {
+                heap.push_back (v);
+                key.push_back (k);
+                sift_up (heap.size () - 1);
+            } else if (k < key [pos [v]])
+            {
+                key [pos [v]] = k;
+                sift_up (pos [v]);
+            }
+        }
+
+        vertex_t pop ()
+        {
+            const vertex_t v = heap [0];
+            pos [v] = heap_npos;
+            heap [0] = heap.back ();
+            key [0] = key.back ();
+            heap.pop_back ();
+            key.pop_back ();
+            if (!heap.empty ())
+                sift_down (0);
+            return v;
+        }
+
+        // Remove all remaining entries in O(size)
+        void clear ()
+        {
+            for (auto v : heap)
+                pos [v] = heap_npos;
+            heap.clear ();
+            key.clear ();
+        }
+};
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                            SP_WORKSPACE                            **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// Distance and predecessor arrays valid only where stamp [v] == current, so
+// starting a new query costs O(1) instead of O(V).
+struct sp_workspace_t
+{
+    std::vector <weight_t> dist;
+    std::vector <vertex_t> prev;
+    std::vector <unsigned> stamp;
+    unsigned current = 0;
+    dheap_t heap;
+
+    void resize (size_t n)
+    {
+        if (stamp.size () == n)
+            return;
+        dist.resize (n);
+        prev.resize (n);
+        stamp.assign (n, 0);
+        current = 0;
+        heap.resize (n);
+    }
+
+    void next_query ()
+    {
+        heap.clear ();
+        if (++current == 0) // wrapped around
+        {
+            std::fill (stamp.begin (), stamp.end (), 0);
+            current = 1;
+        }
+    }
+
+    bool reached (vertex_t v) const { return stamp [v] == current; }
+    weight_t distance (vertex_t v) const
+    {
+        return reached (v) ? dist [v] : max_weight;
+    }
+    vertex_t previous (vertex_t v) const { return reached (v) ? prev [v] : -1; }
+    void set (vertex_t v, weight_t d, vertex_t p)
+    {
+        dist [v] = d;
+        prev [v] = p;
+        stamp [v] = current;
+    }
+
+    // Path from the search source to v, or just {v} if v was not reached
+    std::vector <vertex_t> path_to (vertex_t v) const
+    {
+        std::vector <vertex_t> path;
+        for ( ; v != -1; v = previous (v))
+            path.push_back (v);
+        std::reverse (path.begin (), path.end ());
+        return path;
+    }
+};
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                          DIJKSTRA_SEARCH                           **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// Dijkstra from source over g, stopping once target is settled (pass target
+// = -1 to settle the whole graph). Returns the number of settled vertices.
+inline size_t dijkstra_search (const csr_graph_t &g, vertex_t source,
+        vertex_t target, sp_workspace_t &ws)
+{
+    ws.resize (g.nvertices);
+    ws.next_query ();
+    ws.set (source, 0.0, -1);
+    ws.heap.push (source, 0.0);
+
+    size_t nsettled = 0;
+    while (!ws.heap.empty ())
+    {
+        const weight_t dist = ws.heap.top_key ();
+        const vertex_t u = ws.heap.pop ();
+        nsettled++;
+        if (u == target)
+            break;
+
+        for (size_t k = g.offsets [u]; k < g.offsets [u + 1]; k++)
+        {
+            const vertex_t v = g.targets [k];
+            const weight_t distance_through_u = dist + g.weights [k];
+            if (distance_through_u < ws.distance (v))
+            {
+                ws.set (v, distance_through_u, u);
+                ws.heap.push (v, distance_through_u);
+            }
+        }
+    }
+    ws.heap.clear ();
+
+    return nsettled;
+}
+
+// Dijkstra from source, stopping once all ntargets distinct vertices flagged
+// in is_target are settled. Returns the number of settled vertices.
+inline size_t dijkstra_search_targets (const csr_graph_t &g, vertex_t source,
+        const std::vector <bool> &is_target, size_t ntargets,
+        sp_workspace_t &ws)
+{
+    ws.resize (g.nvertices);
+    ws.next_query ();
+    ws.set (source, 0.0, -1);
+    ws.heap.push (source, 0.0);
+
+    size_t nsettled = 0;
+    while (!ws.heap.empty () && ntargets > 0)
+    {
+        const weight_t dist = ws.heap.top_key ();
+        const vertex_t u = ws.heap.pop ();
+        nsettled++;
+        if (is_target [u])
+            ntargets--;
+
+        for (size_t k = g.offsets [u]; k < g.offsets [u + 1]; k++)
+        {
+            const vertex_t v = g.targets [k];
+            const weight_t distance_through_u = dist + g.weights [k];
+            if (distance_through_u < ws.distance (v))
+            {
+                ws.set (v, distance_through_u, u);
+                ws.heap.push (v, distance_through_u);
+            }
+        }
+    }
+    ws.heap.clear ();
+
+    return nsettled;
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                            ASTAR_SEARCH                            **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// A* from source to target, with heap keys dist + heuristic (v). The
+// heuristic must be a lower bound on the remaining distance to target, and
+// should be consistent; should a settled vertex nevertheless be improved it
+// is simply re-inserted. Returns the number of settled vertices.
+template <typename H>
+inline size_t astar_search (const csr_graph_t &g, vertex_t source,
+        vertex_t target, const H &heuristic, sp_workspace_t &ws)
+{
+    ws.resize (g.nvertices);
+    ws.next_query ();
+    ws.set (source, 0.0, -1);
+    ws.heap.push (source, heuristic (source));
+
+    size_t nsettled = 0;
+    while (!ws.heap.empty ())
+    {
+        const vertex_t u = ws.heap.pop ();
+        nsettled++;
+        if (u == target)
+            break;
+
+        const weight_t dist = ws.distance (u);
+        for (size_t k = g.offsets [u]; k < g.offsets [u + 1]; k++)
+        {
+            const vertex_t v = g.targets [k];
+            const weight_t distance_through_u = dist + g.weights [k];
+            if (distance_through_u < ws.distance (v))
+            {
+                ws.set (v, distance_through_u, u);
+                ws.heap.push (v, distance_through_u + heuristic (v));
+            }
+        }
+    }
+    ws.heap.clear ();
+
+    return nsettled;
+}
+
+/************************************************************************
+ ************************************************************************
+ **                                                                    **
+ **                        BIDIRECTIONAL_SEARCH                        **
+ **                                                                    **
+ ************************************************************************
+ ************************************************************************/
+
+// Bidirectional Dijkstra: forward over g from source and backward over grev
+// (= g.reversed ()) from target, always advancing the side with the smaller
+// heap. Stops once the two heap minima sum to at least the best source-target
+// distance seen so far, which is then optimal. meet is set to a vertex on the
+// shortest path, or -1 if target is unreachable. Returns the number of
+// settled vertices over both directions.
+inline size_t bidirectional_search (const csr_graph_t &g,
+        const csr_graph_t &grev, vertex_t source, vertex_t target,
+        sp_workspace_t &ws_fwd, sp_workspace_t &ws_bwd, vertex_t &meet)
+{
+    ws_fwd.resize (g.nvertices);
+    ws_bwd.resize (grev.nvertices);
+    ws_fwd.next_query ();
+    ws_bwd.next_query ();
+    ws_fwd.set (source, 0.0, -1);
+    ws_fwd.heap.push (source, 0.0);
+    ws_bwd.set (target, 0.0, -1);
+    ws_bwd.heap.push (target, 0.0);
+
+    weight_t best = max_weight;
+    meet = -1;
+    if (source == target)
+    {
+        best = 0.0;
+        meet = source;
+    }
+
+    size_t nsettled = 0;
+    while (!ws_fwd.heap.empty () && !ws_bwd.heap.empty ())
+    {
+        if (ws_fwd.heap.top_key () + ws_bwd.heap.top_key () >= best)
+            break;
+
+        const bool forward = ws_fwd.heap.size () <= ws_bwd.heap.size ();
+        sp_workspace_t &ws = forward ? ws_fwd : ws_bwd;
+        const sp_workspace_t &ws_other = forward ? ws_bwd : ws_fwd;
+        const csr_graph_t &gr = forward ? g : grev;
+
+        const weight_t dist = ws.heap.top_key ();
+        const vertex_t u = ws.heap.pop ();
+        nsettled++;
+
+        for (size_t k = gr.offsets [u]; k < gr.offsets [u + 1]; k++)
+        {
+            const vertex_t v = gr.targets [k];
+            const weight_t distance_through_u = dist + gr.weights [k];
+            if (distance_through_u < ws.distance (v))
+            {
+                ws.set (v, distance_through_u, u);
+                ws.heap.push (v, distance_through_u);
+            }
+            if (ws_other.reached (v) &&
+                    distance_through_u + ws_other.distance (v) < best)
+            {
+                best = distance_through_u + ws_other.distance (v);
+                meet = v;
+            }
+        }
+    }
+    ws_fwd.heap.clear ();
+    ws_bwd.heap.clear ();
+
+    return nsettled;
+}